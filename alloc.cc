@@ -0,0 +1,191 @@
+// alloc.cc   (c) Christian Balkenius 2024
+
+#include "alloc.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <unistd.h>
+
+namespace ikaros
+{
+    struct thread_counters // plain data so that it needs no construction before the first allocation
+    {
+        long            count;
+        long            bytes;
+        long            violations;
+        const char *    guard;      // name of the innermost no_alloc_scope or nullptr
+        bool            abort;
+    };
+
+    static thread_local thread_counters local;
+    static std::atomic<long> total_count{0};
+    static std::atomic<long> total_bytes{0};
+    static std::atomic<long> total_violations{0};
+
+
+    static void
+    report(const char * guard, size_t size) // write() does not allocate
+    {
+        char message[256];
+        std::snprintf(message, sizeof(message), "Allocation of %zu bytes inside %s\n", size, guard);
+        ::write(2, message, std::strlen(message));
+    }
+
+
+    static void
+    count(size_t size)
+    {
+        local.count++;
+        local.bytes += size;
+        total_count.fetch_add(1, std::memory_order_relaxed);
+        total_bytes.fetch_add(size, std::memory_order_relaxed);
+        if(local.guard)
+        {
+            local.violations++;
+            total_violations.fetch_add(1, std::memory_order_relaxed);
+            const char * guard = local.guard;
+            local.guard = nullptr; // the report itself must not trigger the guard
+            report(guard, size);
+            if(local.abort)
+                std::abort();
+            local.guard = guard;
+        }
+    }
+
+
+    alloc_stats
+    thread_allocations()
+    {
+        alloc_stats s;
+        s.count = local.count;
+        s.bytes = local.bytes;
+        s.violations = local.violations;
+        return s;
+    }
+
+
+    alloc_stats
+    total_allocations()
+    {
+        alloc_stats s;
+        s.count = total_count.load(std::memory_order_relaxed);
+        s.bytes = total_bytes.load(std::memory_order_relaxed);
+        s.violations = total_violations.load(std::memory_order_relaxed);
+        return s;
+    }
+
+
+#ifdef DEBUG
+    no_alloc_scope::no_alloc_scope(const char * name, bool abort_on_alloc) :
+        previous_name_(local.guard),
+        previous_abort_(local.abort)
+    {
+        local.guard = name;
+        local.abort = abort_on_alloc;
+    }
+
+
+    no_alloc_scope::~no_alloc_scope()
+    {
+        local.guard = previous_name_;
+        local.abort = previous_abort_;
+    }
+#endif
+};
+
+
+// Replacements of the global allocation functions. Over-aligned types such as the alignas(64)
+// queues and cells use the align_val_t forms, which are replaced as well so that they are counted
+// and guarded too.
+
+void *
+operator new(size_t size)
+{
+    ikaros::count(size);
+    if(void * p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+
+void *
+operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+
+void *
+operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    ikaros::count(size);
+    return std::malloc(size ? size : 1);
+}
+
+
+void *
+operator new[](size_t size, const std::nothrow_t & tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete[](void * p) noexcept { std::free(p); }
+void operator delete(void * p, size_t) noexcept { std::free(p); }
+void operator delete[](void * p, size_t) noexcept { std::free(p); }
+
+
+static void *
+aligned_malloc(size_t size, std::align_val_t alignment) noexcept
+{
+    ikaros::count(size);
+    size_t a = std::max(sizeof(void *), static_cast<size_t>(alignment));
+    void * p = nullptr;
+    if(posix_memalign(&p, a, size ? size : 1) != 0)
+        return nullptr;
+    return p;
+}
+
+
+void *
+operator new(size_t size, std::align_val_t alignment)
+{
+    if(void * p = aligned_malloc(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+
+void *
+operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+
+void *
+operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return aligned_malloc(size, alignment);
+}
+
+
+void *
+operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return aligned_malloc(size, alignment);
+}
+
+
+void operator delete(void * p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void * p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void * p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void * p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void * p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void * p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
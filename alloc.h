@@ -0,0 +1,51 @@
+// alloc.h - allocation accounting and a guard against allocation in real-time code (c) Christian Balkenius 2024
+//
+// alloc.cc replaces the global operator new and delete so that every allocation is counted, per thread
+// and for the whole process. The counts cost a few increments per allocation.
+//
+// A no_alloc_scope marks code that must not allocate, such as an audio callback:
+//
+//      void callback(...) { ikaros::no_alloc_scope guard("audio callback"); ... }
+//
+// In debug builds an allocation inside the scope is counted as a violation and reported on stderr,
+// or aborts the program when the guard is created with abort_on_alloc. In other builds the guard does
+// nothing. Only allocations are checked; freeing memory inside the scope is allowed.
+
+#ifndef ALLOC
+#define ALLOC
+
+#include <cstddef>
+
+namespace ikaros
+{
+    struct alloc_stats
+    {
+        long    count = 0;      // calls to operator new
+        long    bytes = 0;      // bytes requested
+        long    violations = 0; // allocations inside a no_alloc_scope
+    };
+
+    alloc_stats thread_allocations();   // by the calling thread since it started
+    alloc_stats total_allocations();    // by all threads
+
+    class no_alloc_scope
+    {
+    public:
+#ifdef DEBUG
+        no_alloc_scope(const char * name="no_alloc_scope", bool abort_on_alloc=false);
+        ~no_alloc_scope();
+#else
+        no_alloc_scope(const char * = "no_alloc_scope", bool = false) {}
+#endif
+        no_alloc_scope(const no_alloc_scope &) = delete;
+        no_alloc_scope & operator=(const no_alloc_scope &) = delete;
+
+    private:
+#ifdef DEBUG
+        const char *        previous_name_;
+        bool                previous_abort_;
+#endif
+    };
+};
+
+#endif
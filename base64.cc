@@ -0,0 +1,473 @@
+// base64.cc   (c) Christian Balkenius 2024
+//
+// The SIMD kernels follow the algorithms by Wojciech Muła and Daniel Lemire:
+// the bytes are shuffled into 6-bit fields with multiplications and translated with table lookups.
+// The kernels only process complete blocks without padding; the scalar code does the rest.
+// x86 kernels are compiled with target attributes and selected at run time.
+
+#include "base64.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BASE64_X86
+#include <immintrin.h>
+#endif
+
+namespace ikaros
+{
+    static const char encoding_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    struct decoding_table_type
+    {
+        signed char value[256];
+        decoding_table_type()
+        {
+            std::memset(value, -1, sizeof(value));
+            for(int i=0; i<64; i++)
+                value[static_cast<unsigned char>(encoding_table[i])] = i;
+        }
+    };
+
+    static const decoding_table_type decoding_table;
+
+    // Scalar kernels for complete groups
+
+    static size_t
+    encode_scalar(const unsigned char * in, size_t n, char * out) // n is a multiple of 3
+    {
+        for(size_t i=0; i<n; i+=3)
+        {
+            unsigned int triple = (in[i] << 16) | (in[i+1] << 8) | in[i+2];
+            *out++ = encoding_table[(triple >> 18) & 0x3F];
+            *out++ = encoding_table[(triple >> 12) & 0x3F];
+            *out++ = encoding_table[(triple >> 6) & 0x3F];
+            *out++ = encoding_table[triple & 0x3F];
+        }
+        return n;
+    }
+
+
+    static size_t
+    decode_scalar(const char * in, size_t n, unsigned char * out) // n is a multiple of 4; stops at padding or invalid characters and returns the number of characters used
+    {
+        size_t i = 0;
+        for(; i<n; i+=4)
+        {
+            int a = decoding_table.value[static_cast<unsigned char>(in[i])];
+            int b = decoding_table.value[static_cast<unsigned char>(in[i+1])];
+            int c = decoding_table.value[static_cast<unsigned char>(in[i+2])];
+            int d = decoding_table.value[static_cast<unsigned char>(in[i+3])];
+            if((a | b | c | d) < 0)
+                break;
+            unsigned int triple = (a << 18) | (b << 12) | (c << 6) | d;
+            *out++ = triple >> 16;
+            *out++ = triple >> 8;
+            *out++ = triple;
+        }
+        return i;
+    }
+
+    // SIMD kernels; each returns the number of input bytes or characters consumed
+
+#ifdef BASE64_X86
+
+    __attribute__((target("ssse3")))
+    static inline __m128i
+    encode_translate_ssse3(__m128i in) // 16 values 0-63 to characters
+    {
+        const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+        __m128i indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+        __m128i mask = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+        indices = _mm_sub_epi8(indices, mask);
+        return _mm_add_epi8(in, _mm_shuffle_epi8(lut, indices));
+    }
+
+
+    __attribute__((target("ssse3")))
+    static inline __m128i
+    encode_reshuffle_ssse3(__m128i in) // 12 bytes to 16 values 0-63
+    {
+        in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(t1, t3);
+    }
+
+
+    __attribute__((target("ssse3")))
+    static size_t
+    encode_ssse3(const unsigned char * in, size_t n, char * out)
+    {
+        size_t i = 0;
+        for(; i+16 <= n; i+=12, out+=16) // reads 16 bytes and uses 12
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), encode_translate_ssse3(encode_reshuffle_ssse3(v)));
+        }
+        return i;
+    }
+
+
+    __attribute__((target("ssse3")))
+    static size_t
+    decode_ssse3(const char * in, size_t n, unsigned char * out)
+    {
+        const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+        size_t i = 0;
+        for(; i+24 <= n; i+=16, out+=12) // writes 16 bytes and uses 12; the margin keeps the extra bytes inside the output
+        {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+i));
+            __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(s, 4), mask_2f);
+            __m128i lo_nibbles = _mm_and_si128(s, mask_2f);
+            __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+            __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+            if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xFFFF)
+                break; // invalid character or padding
+            __m128i eq_2f = _mm_cmpeq_epi8(s, mask_2f);
+            __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+            s = _mm_add_epi8(s, roll);
+
+            __m128i merged = _mm_maddubs_epi16(s, _mm_set1_epi32(0x01400140));
+            __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+            packed = _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), packed);
+        }
+        return i;
+    }
+
+
+    __attribute__((target("avx2")))
+    static size_t
+    encode_avx2(const unsigned char * in, size_t n, char * out)
+    {
+        const __m256i lut = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+                                             65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+        const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        size_t i = 0;
+        for(; i+28 <= n; i+=24, out+=32) // 12 bytes in each 128-bit lane
+        {
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+i));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+i+12));
+            __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+            v = _mm256_shuffle_epi8(v, shuffle);
+            __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+            __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+            __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+            __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+            v = _mm256_or_si256(t1, t3);
+
+            __m256i indices = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+            __m256i mask = _mm256_cmpgt_epi8(v, _mm256_set1_epi8(25));
+            indices = _mm256_sub_epi8(indices, mask);
+            v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut, indices));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), v);
+        }
+        _mm256_zeroupper(); // the SSE tail and the caller would otherwise pay for the dirty upper halves
+        return i + encode_ssse3(in+i, n-i, out);
+    }
+
+
+    __attribute__((target("avx2")))
+    static size_t
+    decode_avx2(const char * in, size_t n, unsigned char * out)
+    {
+        const __m256i lut_lo = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A));
+        const __m256i lut_hi = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+        const __m256i lut_roll = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+        const __m256i pack = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+
+        size_t i = 0;
+        unsigned char * o = out;
+        for(; i+48 <= n; i+=32, o+=24) // writes 32 bytes and uses 24
+        {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in+i));
+            __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(s, 4), mask_2f);
+            __m256i lo_nibbles = _mm256_and_si256(s, mask_2f);
+            __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+            __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+            if(!_mm256_testz_si256(lo, hi))
+                break;
+            __m256i eq_2f = _mm256_cmpeq_epi8(s, mask_2f);
+            __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+            s = _mm256_add_epi8(s, roll);
+
+            __m256i merged = _mm256_maddubs_epi16(s, _mm256_set1_epi32(0x01400140));
+            __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+            packed = _mm256_shuffle_epi8(packed, pack);
+            packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(o), packed);
+        }
+        _mm256_zeroupper();
+        return i + decode_ssse3(in+i, n-i, o);
+    }
+
+#endif
+
+    // Kernel selection
+
+    typedef size_t (*encode_kernel)(const unsigned char *, size_t, char *);
+    typedef size_t (*decode_kernel)(const char *, size_t, unsigned char *);
+
+    static size_t encode_none(const unsigned char *, size_t, char *) { return 0; }
+    static size_t decode_none(const char *, size_t, unsigned char *) { return 0; }
+
+    struct kernels
+    {
+        encode_kernel encode;
+        decode_kernel decode;
+        kernels();
+    };
+
+    static void
+    assign(kernels & k, base64_isa isa)
+    {
+        k.encode = encode_none;
+        k.decode = decode_none;
+        #ifdef BASE64_X86
+        if(isa == base64_isa::avx2)
+        {
+            k.encode = encode_avx2;
+            k.decode = decode_avx2;
+        }
+        else if(isa == base64_isa::ssse3)
+        {
+            k.encode = encode_ssse3;
+            k.decode = decode_ssse3;
+        }
+        #endif
+    }
+
+    kernels::kernels()
+    {
+        assign(*this, base64_best_isa());
+    }
+
+    static kernels & selected()
+    {
+        static kernels k;
+        return k;
+    }
+
+
+    base64_isa
+    base64_best_isa()
+    {
+        #ifdef BASE64_X86
+        if(__builtin_cpu_supports("avx2"))
+            return base64_isa::avx2;
+        if(__builtin_cpu_supports("ssse3"))
+            return base64_isa::ssse3;
+        #endif
+        return base64_isa::scalar;
+    }
+
+
+    void
+    base64_set_isa(base64_isa isa)
+    {
+        assign(selected(), isa);
+    }
+
+    // Encoding
+
+    static size_t
+    encode_groups(const unsigned char * in, size_t n, char * out) // n is a multiple of 3
+    {
+        size_t i = selected().encode(in, n, out);
+        encode_scalar(in+i, n-i, out+i/3*4);
+        return n/3*4;
+    }
+
+
+    static size_t
+    encode_final(const unsigned char * in, size_t n, char * out) // one or two bytes with padding
+    {
+        if(n == 0)
+            return 0;
+        unsigned int triple = (in[0] << 16) | (n > 1 ? in[1] << 8 : 0);
+        out[0] = encoding_table[(triple >> 18) & 0x3F];
+        out[1] = encoding_table[(triple >> 12) & 0x3F];
+        out[2] = n > 1 ? encoding_table[(triple >> 6) & 0x3F] : '=';
+        out[3] = '=';
+        return 4;
+    }
+
+
+    size_t
+    base64_encode(const unsigned char * data, size_t size, char * out)
+    {
+        size_t full = size/3*3;
+        size_t k = encode_groups(data, full, out);
+        return k + encode_final(data+full, size-full, out+k);
+    }
+
+
+    char *
+    base64_encode(const unsigned char * data,
+                  size_t size_in,
+                  size_t *size_out)
+    {
+        *size_out = base64_encoded_size(size_in);
+        char *encoded_data = (char *)malloc(*size_out > 0 ? *size_out : 1);
+        if (encoded_data == NULL) return NULL;
+        base64_encode(data, size_in, encoded_data);
+        return encoded_data;
+    }
+
+
+    std::string
+    base64_encode(const std::string & data)
+    {
+        std::string s(base64_encoded_size(data.size()), '\0');
+        base64_encode(reinterpret_cast<const unsigned char *>(data.data()), data.size(), &s[0]);
+        return s;
+    }
+
+    // Decoding
+
+    static size_t
+    decode_groups(const char * in, size_t n, unsigned char * out, bool & finished) // n is a multiple of 4; handles padding in the last group
+    {
+        unsigned char * o = out;
+        size_t i = selected().decode(in, n, o);
+        o += i/4*3;
+        while(i < n)
+        {
+            size_t k = decode_scalar(in+i, n-i, o);
+            i += k;
+            o += k/4*3;
+            if(i == n)
+                break;
+
+            // padding or an invalid character in group i
+
+            int a = decoding_table.value[static_cast<unsigned char>(in[i])];
+            int b = decoding_table.value[static_cast<unsigned char>(in[i+1])];
+            int c = decoding_table.value[static_cast<unsigned char>(in[i+2])];
+            bool last = i+4 == n;
+            if(last && a >= 0 && b >= 0 && c >= 0 && in[i+3] == '=')
+            {
+                unsigned int triple = (a << 18) | (b << 12) | (c << 6);
+                *o++ = triple >> 16;
+                *o++ = triple >> 8;
+            }
+            else if(last && a >= 0 && b >= 0 && in[i+2] == '=' && in[i+3] == '=')
+                *o++ = ((a << 18) | (b << 12)) >> 16;
+            else
+            {
+                size_t p = i;
+                while(decoding_table.value[static_cast<unsigned char>(in[p])] >= 0)
+                    p++;
+                throw std::invalid_argument(std::string("Invalid base64 ") + (in[p] == '=' ? "padding" : "character") + " at position " + std::to_string(p) + ".");
+            }
+            i += 4;
+            finished = true;
+        }
+        return o-out;
+    }
+
+
+    size_t
+    base64_decode(const char * data, size_t size, unsigned char * out)
+    {
+        if(size % 4 != 0)
+            throw std::invalid_argument("Base64 data must be a multiple of four characters.");
+        bool finished = false;
+        return decode_groups(data, size, out, finished);
+    }
+
+
+    std::vector<unsigned char>
+    base64_decode(const std::string & data)
+    {
+        std::vector<unsigned char> v(base64_decoded_size(data.size()));
+        v.resize(base64_decode(data.data(), data.size(), v.data()));
+        return v;
+    }
+
+    // Streaming
+
+    size_t
+    base64_encoder::update(const unsigned char * data, size_t size, char * out)
+    {
+        size_t k = 0;
+        while(pending_size_ > 0 && pending_size_ < 3 && size > 0)
+        {
+            pending_[pending_size_++] = *data++;
+            size--;
+        }
+        if(pending_size_ == 3)
+        {
+            k = encode_groups(pending_, 3, out);
+            pending_size_ = 0;
+        }
+        size_t full = size/3*3;
+        k += encode_groups(data, full, out+k);
+        for(size_t i=full; i<size; i++)
+            pending_[pending_size_++] = data[i];
+        return k;
+    }
+
+
+    size_t
+    base64_encoder::finish(char * out)
+    {
+        size_t k = encode_final(pending_, pending_size_, out);
+        pending_size_ = 0;
+        return k;
+    }
+
+
+    size_t
+    base64_decoder::update(const char * data, size_t size, unsigned char * out)
+    {
+        if(size == 0)
+            return 0;
+        if(finished_)
+            throw std::invalid_argument("Base64 data after padding.");
+
+        size_t k = 0;
+        while(pending_size_ > 0 && pending_size_ < 4 && size > 0)
+        {
+            pending_[pending_size_++] = *data++;
+            size--;
+        }
+        if(pending_size_ == 4)
+        {
+            pending_size_ = 0;
+            k = decode_groups(pending_, 4, out, finished_);
+            if(finished_ && size > 0)
+                throw std::invalid_argument("Base64 data after padding.");
+        }
+        size_t full = size/4*4;
+        k += decode_groups(data, full, out+k, finished_);
+        for(size_t i=full; i<size; i++)
+            pending_[pending_size_++] = data[i];
+        if(finished_ && pending_size_ > 0)
+            throw std::invalid_argument("Base64 data after padding.");
+        return k;
+    }
+
+
+    void
+    base64_decoder::finish()
+    {
+        int left = pending_size_;
+        pending_size_ = 0;
+        finished_ = false;
+        if(left != 0)
+            throw std::invalid_argument("Base64 data ended inside a group of four characters.");
+    }
+};
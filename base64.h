@@ -0,0 +1,52 @@
+// base64.h - base64 encoding and decoding with SIMD kernels (c) Christian Balkenius 2024
+
+#ifndef BASE64
+#define BASE64
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ikaros
+{
+    char * base64_encode(const unsigned char * data, size_t size_in, size_t *size_out); // returns a malloc'd buffer that the caller must free
+
+    inline size_t base64_encoded_size(size_t n) { return (n+2)/3*4; }   // with padding
+    inline size_t base64_decoded_size(size_t n) { return n/4*3; }       // upper bound; padding makes the result up to two bytes shorter
+
+    size_t base64_encode(const unsigned char * data, size_t size, char * out);          // writes base64_encoded_size(size) characters to out without a terminating zero
+    size_t base64_decode(const char * data, size_t size, unsigned char * out);          // writes the bytes to out and returns their number; throws std::invalid_argument on malformed input
+
+    std::string base64_encode(const std::string & data);
+    std::vector<unsigned char> base64_decode(const std::string & data);
+
+    enum class base64_isa { scalar, ssse3, avx2 };
+
+    base64_isa base64_best_isa();           // fastest kernel supported by this processor
+    void base64_set_isa(base64_isa isa);    // select kernel; the default is base64_best_isa()
+
+    class base64_encoder // streaming encoder; the output is identical to encoding all data at once
+    {
+    public:
+        size_t update(const unsigned char * data, size_t size, char * out); // out needs room for base64_encoded_size(size+2) characters; returns the number written
+        size_t finish(char * out);  // writes at most four characters with padding and resets the encoder
+
+    private:
+        unsigned char   pending_[3];
+        int             pending_size_ = 0;
+    };
+
+    class base64_decoder // streaming decoder; data after the padding is an error
+    {
+    public:
+        size_t update(const char * data, size_t size, unsigned char * out); // out needs room for base64_decoded_size(size+3) bytes; returns the number written
+        void finish();  // throws if the input ended in the middle of a group of four characters; resets the decoder
+
+    private:
+        char            pending_[4];
+        int             pending_size_ = 0;
+        bool            finished_ = false;
+    };
+};
+
+#endif
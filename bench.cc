@@ -0,0 +1,570 @@
+// bench.cc - timing of the synth and matrix operations
+//
+//      matrix_bench [--json <file>] [--repetitions <n>] [--warmup <n>] [--filter <text>] [--help]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "alloc.h"
+#include "dynamics.h"
+#include "matrix.h"
+#include "matrix_io.h"
+#include "mixer.h"
+#include "patch.h"
+#include "pcm.h"
+#include "range.h"
+#include "resampler.h"
+#include "r2d2synth.h"
+
+using namespace ikaros;
+
+// Each benchmark is run a few times to warm up and then timed over a number of repetitions.
+// The median and the 10th and 90th percentiles are printed, and all results can be written as JSON
+// to compare runs between releases. Allocations are counted by all threads during the timed runs;
+// benchmarks that render audio also report them per second of rendered sound.
+
+struct measurement
+{
+    std::string         name;
+    long                bytes;
+    double              seconds = 0;            // of audio rendered by each run
+    std::vector<double> ms;                     // sorted times of the repetitions
+    double              allocations = 0;        // per run
+    double              allocated_bytes = 0;    // per run
+};
+
+static std::vector<measurement> results;
+static int warmup = 2;
+static int repetitions = 20;    // default; benchmarks may ask for fewer
+static std::string filter;      // run only benchmarks whose name contains this
+
+
+static double
+percentile(const std::vector<double> & sorted, double p) // linear interpolation between the closest ranks
+{
+    double x = p * (sorted.size()-1);
+    int i = int(x);
+    if(i+1 >= sorted.size())
+        return sorted.back();
+    return sorted[i] + (x-i) * (sorted[i+1]-sorted[i]);
+}
+
+
+template <typename F>
+void
+measure(const std::string & name, long bytes, F f, int count=0, double seconds=0)
+{
+    if(!filter.empty() && name.find(filter) == std::string::npos)
+        return;
+
+    for(int r=0; r<warmup; r++)
+        f();
+
+    measurement m{name, bytes, seconds};
+    int n = count > 0 ? std::min(count, repetitions) : repetitions;
+    m.ms.reserve(n);
+    alloc_stats before = total_allocations();
+    for(int r=0; r<n; r++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double, std::milli> t = std::chrono::steady_clock::now()-start;
+        m.ms.push_back(t.count());
+    }
+    alloc_stats after = total_allocations();
+    m.allocations = double(after.count-before.count)/n;
+    m.allocated_bytes = double(after.bytes-before.bytes)/n;
+    std::sort(m.ms.begin(), m.ms.end());
+
+    double median = percentile(m.ms, 0.5);
+    std::printf("%-48s %10.4f ms  [p10 %.4f, p90 %.4f]  %8.3f GB/s  %8.1f allocs", (name+":").c_str(), median, percentile(m.ms, 0.1), percentile(m.ms, 0.9), (bytes/1e6)/median, m.allocations);
+    if(seconds > 0)
+        std::printf(", %.1f per audio s", m.allocations/seconds);
+    std::printf("\n");
+    results.push_back(m);
+}
+
+
+template <typename F>
+void
+measure_render(const std::string & name, double seconds, F f, int count=0, int sample_rate=44100) // f renders seconds of audio at sample_rate
+{
+    measure(name, long(seconds*sample_rate)*sizeof(float), f, count, seconds);
+}
+
+
+static std::string
+json_string(const std::string & s)
+{
+    std::string r = "\"";
+    for(char c : s)
+    {
+        if(c == '"' || c == '\\')
+            r += '\\';
+        r += c;
+    }
+    return r + "\"";
+}
+
+
+void
+write_json(const std::string & filename)
+{
+    std::ofstream file(filename);
+    if(!file)
+        throw exception("Could not write \""+filename+"\".");
+    file << "[\n";
+    for(int i=0; i<results.size(); i++)
+    {
+        auto & m = results[i];
+        double median = percentile(m.ms, 0.5);
+        file << "  {\"name\": " << json_string(m.name)
+             << ", \"repetitions\": " << m.ms.size()
+             << ", \"bytes\": " << m.bytes
+             << ", \"min_ms\": " << m.ms.front()
+             << ", \"p10_ms\": " << percentile(m.ms, 0.1)
+             << ", \"median_ms\": " << median
+             << ", \"p90_ms\": " << percentile(m.ms, 0.9)
+             << ", \"max_ms\": " << m.ms.back()
+             << ", \"gb_per_s\": " << (m.bytes/1e6)/median
+             << ", \"allocations_per_run\": " << m.allocations
+             << ", \"allocated_bytes_per_run\": " << m.allocated_bytes;
+        if(m.seconds > 0)
+            file << ", \"allocations_per_audio_second\": " << m.allocations/m.seconds;
+        file
+             << "}" << (i+1 < results.size() ? "," : "") << "\n";
+    }
+    file << "]\n";
+}
+
+
+void
+bench_copy()
+{
+    const int samples = 1 << 20; // 1M samples of audio
+    matrix source(samples);
+    matrix target(samples);
+    for(int i=0; i<samples; i++)
+        source(i) = std::sin(0.01f*i);
+
+    measure("copy 1M samples, element by element", 2L*samples*sizeof(float), [&]() {
+        for(int i=0; i<samples; i++)
+            target.data_->at(i) = source.data_->at(i);
+    });
+
+    measure("copy 1M samples", 2L*samples*sizeof(float), [&]() { target.copy(source); });
+
+    matrix channels(2, samples/2); // two channels of a larger buffer
+    matrix block(2, samples/2);
+    block.resize(2, samples/4);
+    channels.resize(2, samples/4);
+    measure("copy 2 x 256k samples, strided", 2L*(samples/2)*sizeof(float), [&]() { block.copy(channels); });
+}
+
+
+void
+bench_load()
+{
+    const int samples = 1 << 16;
+    matrix clip(samples);
+    std::string text;
+    std::string sep;
+    for(int i=0; i<samples; i++)
+    {
+        clip(i) = std::sin(0.01f*i);
+        text += sep + std::to_string(clip(i));
+        sep = ",";
+    }
+    std::string filename = "bench_clip.ikmx";
+    save_binary(filename, clip);
+
+    measure("parse 64k samples from text", text.size(), [&]() { matrix m(text); }, 5);
+    measure("load 64k samples from binary file", samples*sizeof(float), [&]() { matrix m = load_binary(filename); });
+    measure("map 64k samples from binary file", samples*sizeof(float), [&]() { mapped_matrix m(filename); });
+    std::remove(filename.c_str());
+}
+
+
+void
+bench_strings()
+{
+    std::string row;
+    std::string sep;
+    for(int i=0; i<1000; i++)
+    {
+        row += sep + std::to_string(i*0.5f);
+        sep = ", ";
+    }
+    std::string path = "synth.voices.r2d2.happy.chirp.rate";
+    const int n = 1000;
+    size_t sink = 0;
+
+    measure("split 1000 values", row.size(), [&]() { sink += split(row, ",").size(); });
+    measure("split_view 1000 values", row.size(), [&]() { sink += split_view(row, ",").size(); });
+    measure("split_range 1000 values", row.size(), [&]() { for(auto p : split_range(row, ",")) sink += p.size(); });
+
+    measure("trim x1000", 9*n, [&]() { for(int i=0; i<n; i++) sink += trim("  value  ").size(); });
+    measure("trim_view x1000", 9*n, [&]() { for(int i=0; i<n; i++) sink += trim_view("  value  ").size(); });
+
+    measure("head over path x1000", path.size()*n, [&]() {
+        for(int i=0; i<n; i++)
+            for(std::string s = path; !s.empty();)
+                sink += head(s, ".").size();
+    });
+    measure("head over path view x1000", path.size()*n, [&]() {
+        for(int i=0; i<n; i++)
+            for(std::string_view s = path; !s.empty();)
+                sink += head(s, ".").size();
+    });
+
+    measure("peek_tail x1000", path.size()*n, [&]() { for(int i=0; i<n; i++) sink += peek_tail(path, ".").size(); });
+    measure("peek_tail_view x1000", path.size()*n, [&]() { for(int i=0; i<n; i++) sink += peek_tail_view(path, ".").size(); });
+
+    measure("parse range x1000", 18*n, [&]() { for(int i=0; i<n; i++) sink += range("[0:10][2][0:100:2]").rank(); });
+
+    if(sink == 0)
+        std::cout << std::endl; // keeps the results in use
+}
+
+
+void
+bench_base64()
+{
+    const int samples = 1 << 20; // 4 MB of float PCM
+    std::vector<float> pcm(samples);
+    for(int i=0; i<samples; i++)
+        pcm[i] = std::sin(0.01f*i);
+    const unsigned char * bytes = reinterpret_cast<const unsigned char *>(pcm.data());
+    size_t n = samples*sizeof(float);
+    std::vector<char> text(base64_encoded_size(n));
+    std::vector<unsigned char> decoded(n);
+
+    std::pair<base64_isa, std::string> kernels[] = {{base64_isa::scalar, "scalar"}, {base64_isa::ssse3, "ssse3"}, {base64_isa::avx2, "avx2"}};
+    for(auto & k : kernels)
+    {
+        if(k.first > base64_best_isa())
+            continue;
+        base64_set_isa(k.first);
+        measure("base64 encode 4 MB, "+k.second, n, [&]() { base64_encode(bytes, n, text.data()); });
+        measure("base64 decode 4 MB, "+k.second, text.size(), [&]() { base64_decode(text.data(), text.size(), decoded.data()); });
+    }
+    base64_set_isa(base64_best_isa());
+}
+
+
+void
+bench_pcm() // one second of audio; compare with the generators, which render the same amount
+{
+    const int samples = 44100;
+    std::vector<float> audio(samples);
+    for(int i=0; i<samples; i++)
+        audio[i] = 0.8f*std::sin(0.01f*i);
+    std::vector<unsigned char> data(4*samples);
+    std::vector<float> decoded(samples);
+    pcm_dither dither;
+
+    std::pair<pcm_isa, std::string> kernels[] = {{pcm_isa::scalar, "scalar"}, {pcm_isa::sse41, "sse4.1"}, {pcm_isa::avx2, "avx2"}};
+    std::pair<pcm_format, std::string> formats[] = {{pcm_format::s16, "s16"}, {pcm_format::s24, "s24"}, {pcm_format::s32, "s32"}};
+    for(auto & k : kernels)
+    {
+        if(k.first > pcm_best_isa())
+            continue;
+        pcm_set_isa(k.first);
+        for(auto & f : formats)
+        {
+            measure_render("pcm encode 1 s "+f.second+" dithered, "+k.second, 1, [&]() { pcm_encode(audio.data(), data.data(), samples, f.first, &dither); });
+            measure_render("pcm decode 1 s "+f.second+", "+k.second, 1, [&]() { pcm_decode(data.data(), decoded.data(), samples, f.first); });
+        }
+    }
+    pcm_set_isa(pcm_best_isa());
+}
+
+
+void
+bench_dynamics() // streaming stages on one second of audio against scaling a finished sound by its peak
+{
+    const int samples = 44100;
+    R2D2Synth synth(samples, 1);
+    matrix laughter = synth.generateLaughterSound(1, 1);
+    std::vector<float> audio(2*samples);
+
+    measure_render("normalize 1 s by the peak", 1, [&]() {
+        float peak = 0;
+        for(int i=0; i<samples; i++)
+            peak = std::max(peak, std::fabs(laughter.data()[i]));
+        for(int i=0; i<samples; i++)
+            audio[i] = laughter.data()[i] / peak;
+    });
+
+    for(int channels : {1, 2})
+    {
+        std::string c = channels == 1 ? ", mono" : ", stereo";
+        for(int i=0; i<channels*samples; i++)
+            audio[i] = laughter.data()[i/channels];
+        loudness_normalizer normalizer(samples, channels);
+        limiter peaks(samples, channels);
+        measure_render("loudness normalizer 1 s"+c, 1, [&]() { normalizer.process(audio.data(), samples); });
+        measure_render("limiter 1 s"+c, 1, [&]() { peaks.process(audio.data(), samples); });
+    }
+}
+
+
+void
+bench_resampler() // rendering once and converting against rendering at each rate
+{
+    const int samples = 44100;
+    R2D2Synth synth(samples, 1);
+    matrix happy = synth.generateHappySound(1);
+    std::vector<float> out(2*samples);
+
+    for(int rate : {16000, 22050, 48000})
+    {
+        std::string r = std::to_string(rate);
+        resampler converter(samples, rate);
+        measure_render("resample 1 s to "+r, 1, [&]() { converter.process(happy.data(), samples, out.data()); });
+
+        R2D2Synth direct(rate, 1);
+        measure_render("generateHappySound 1 s at "+r, 1, [&]() { direct.generateHappySound(1); }, 0, rate);
+        measure_render("generateHappySound 1 s resampled to "+r, 1, [&]() { matrix m = synth.generateHappySound(1); resample(m, samples, rate); }, 0, rate);
+    }
+
+    std::pair<resampler_isa, std::string> kernels[] = {{resampler_isa::scalar, "scalar"}, {resampler_isa::avx2, "avx2"}};
+    for(auto & k : kernels)
+    {
+        if(k.first > resampler_best_isa())
+            continue;
+        resampler_set_isa(k.first);
+        resampler converter(samples, 48000);
+        measure_render("resample 1 s to 48000, "+k.second, 1, [&]() { converter.process(happy.data(), samples, out.data()); });
+    }
+    resampler_set_isa(resampler_best_isa());
+}
+
+
+void
+bench_patch()
+{
+    const int samples = 44100;
+    R2D2Synth synth(samples);
+    measure_render("happy sound 1 s, hand-written", 1, [&]() { synth.generateHappySound(1); });
+
+    patch happy = patch::load("patches/happy.patch", samples);
+    measure_render("happy sound 1 s, patch", 1, [&]() { happy.render(1); });
+
+    std::vector<float> block(patch::block_size);
+    measure_render("happy sound 1 s, patch by block", 1, [&]() {
+        happy.start(1);
+        while(!happy.finished())
+            happy.process(block.data(), patch::block_size);
+    });
+}
+
+
+void
+bench_mixer()
+{
+    const char * names[] = {"happy", "surprised", "wow", "protest", "indignation", "laughter", "chirp"};
+    const int voices = 64;
+    const int samples = 44100;
+    std::vector<float> out(samples);
+
+    for(int threads : {1, 0})
+    {
+        mixer crowd(threads);
+        if(threads == 0 && crowd.threads() == 1)
+            continue; // a single core; the case above already has one thread
+        measure_render(std::to_string(voices)+" voices 1 s, "+std::to_string(crowd.threads())+" threads", voices, [&]() {
+            crowd.remove_finished(); // the voices of the last repetition have ended
+            for(int i=0; i<voices; i++)
+                crowd.add(patch::load(std::string("patches/")+names[i % 7]+".patch"), 1.0f/voices, 1, i);
+            crowd.process(out.data(), samples);
+        }, 5);
+    }
+
+    // Spatialized output; the voices are spread around the listener
+
+    std::pair<std::vector<float>, std::string> layouts[] = {{{-30, 30}, "stereo"}, {{-45, 45, 135, 225}, "quad"}};
+    for(auto & layout : layouts)
+    {
+        int channels = int(layout.first.size());
+        std::vector<float> frames(channels*samples);
+        std::vector<std::vector<float>> planes(channels, std::vector<float>(samples));
+        float * planar[mixer::max_channels];
+        for(int c=0; c<channels; c++)
+            planar[c] = planes[c].data();
+
+        mixer crowd(1);
+        crowd.set_speakers(layout.first);
+        for(bool interleaved : {true, false})
+            measure_render(std::to_string(voices)+" voices 1 s, 1 thread, "+layout.second+(interleaved ? " interleaved" : " planar"), voices, [&]() {
+                crowd.remove_finished();
+                for(int i=0; i<voices; i++)
+                {
+                    crowd.add(patch::load(std::string("patches/")+names[i % 7]+".patch"), 1.0f/voices, 1, i);
+                    crowd.set_position(i, i*360.0f/voices, 1+i%4);
+                }
+                if(interleaved)
+                    crowd.process(frames.data(), samples);
+                else
+                    crowd.process(planar, samples);
+            }, 5);
+    }
+}
+
+
+void
+bench_generators()
+{
+    R2D2Synth synth(44100, 1);
+
+    for(float duration : {0.1f, 0.5f, 2.0f})
+    {
+        std::string d = " "+std::to_string(duration).substr(0, 3)+" s";
+        measure_render("generateSound"+d, duration, [&]() { synth.generateSound(duration); });
+        measure_render("generateHappySound"+d, duration, [&]() { synth.generateHappySound(duration); });
+        measure_render("generateSurprisedSound"+d, duration, [&]() { synth.generateSurprisedSound(duration); });
+        measure_render("generateWowSound"+d, duration, [&]() { synth.generateWowSound(duration); });
+        measure_render("generateProtestSound"+d, duration, [&]() { synth.generateProtestSound(duration); });
+        measure_render("generateIndignationSound"+d, duration, [&]() { synth.generateIndignationSound(duration); });
+        measure_render("generateLaughterSound"+d, duration, [&]() { synth.generateLaughterSound(duration, 1); });
+    }
+}
+
+
+void
+bench_band_limited() // rendering band limited at a lower rate against the plain render at 44.1 kHz
+{
+    for(int rate : {44100, 22050, 16000})
+    {
+        R2D2Synth synth(rate, 1);
+        synth.setBandLimited();
+        std::string r = " at "+std::to_string(rate)+", band limited";
+        measure_render("generateSound 2 s"+r, 2, [&]() { synth.generateSound(2); }, 0, rate);
+        measure_render("generateWowSound 2 s"+r, 2, [&]() { synth.generateWowSound(2); }, 0, rate);
+        measure_render("generateIndignationSound 2 s"+r, 2, [&]() { synth.generateIndignationSound(2); }, 0, rate);
+    }
+}
+
+
+void
+bench_matrix()
+{
+    const int size = 512;
+    matrix a(size, size);
+    matrix b(size, size);
+    for(int j=0; j<size; j++)
+        for(int i=0; i<size; i++)
+        {
+            a(j, i) = std::sin(0.01f*(j*size+i));
+            b(j, i) = std::cos(0.01f*(j*size+i));
+        }
+    long bytes = long(size)*size*sizeof(float);
+    float sink = 0;
+
+    // The lambdas leave the values bounded so that repetitions do not end up with denormals
+
+    measure("apply 512x512", bytes, [&]() { a.apply([](float x) { return -x; }); });
+    measure("apply 512x512, two matrices", 2*bytes, [&]() { a.apply(b, [](float x, float y) { return y-x; }); });
+    measure("par_apply 512x512", bytes, [&]() { a.par_apply([](float x) { return -x; }); });
+    measure("reduce 512x512", bytes, [&]() { float s = 0; a.reduce([&](float x) { s += x; }); sink += s; });
+    measure("par_reduce 512x512", bytes, [&]() { sink += a.par_reduce(0, std::plus<float>()); });
+
+    matrix c(size, size);
+    measure("copy 512x512", 2*bytes, [&]() { c.copy(a); });
+
+    matrix p(256, 256);
+    matrix q(256, 256);
+    matrix r(256, 256);
+    for(int j=0; j<256; j++)
+        for(int i=0; i<256; i++)
+        {
+            p(j, i) = a(j, i);
+            q(j, i) = b(j, i);
+        }
+    measure("matmul 256x256", 3L*256*256*sizeof(float), [&]() { r.matmul(p, q); });
+
+    matrix kernel(5, 5);
+    kernel.set(1.0f/25);
+    matrix image(256, 256);
+    matrix filtered(252, 252);
+    measure("conv 256x256 by 5x5", 256L*256*sizeof(float), [&]() { filtered.conv(image, kernel); }, 5);
+
+    matrix t;
+    measure("transpose 512x512", 2*bytes, [&]() { a.transpose(t); });
+
+    measure("range iteration 64x64x64", 64L*64*64*sizeof(int), [&]() {
+        range x(0, 64);
+        x.push(0, 64).push(0, 64);
+        int s = 0;
+        for(; x.more(); x++)
+            s += x.index()[2];
+        sink += s;
+    });
+
+    if(sink == 0)
+        std::cout << std::endl; // keeps the results in use
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    const char * usage = "Usage: matrix_bench [--json <file>] [--repetitions <n>] [--warmup <n>] [--filter <text>] [--help]";
+    std::string json;
+    for(int i=1; i<argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--help")
+        {
+            std::cout << usage << std::endl;
+            return 0;
+        }
+        if(arg != "--json" && arg != "--repetitions" && arg != "--warmup" && arg != "--filter")
+        {
+            std::cerr << "Unknown option " << arg << std::endl << usage << std::endl;
+            return 1;
+        }
+        if(i+1 == argc)
+        {
+            std::cerr << "Missing value for " << arg << std::endl << usage << std::endl;
+            return 1;
+        }
+        try
+        {
+            if(arg == "--json")
+                json = argv[++i];
+            else if(arg == "--repetitions")
+                repetitions = std::max(1, std::stoi(argv[++i]));
+            else if(arg == "--warmup")
+                warmup = std::max(0, std::stoi(argv[++i]));
+            else
+                filter = argv[++i];
+        }
+        catch(const std::exception &) // from std::stoi
+        {
+            std::cerr << "Bad value " << argv[i] << " for " << arg << std::endl << usage << std::endl;
+            return 1;
+        }
+    }
+
+    bench_generators();
+    bench_band_limited();
+    bench_matrix();
+    bench_copy();
+    bench_load();
+    bench_strings();
+    bench_base64();
+    bench_pcm();
+    bench_dynamics();
+    bench_resampler();
+    bench_patch();
+    bench_mixer();
+
+    if(!json.empty())
+        write_json(json);
+    return 0;
+}
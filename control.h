@@ -0,0 +1,180 @@
+// control.h - control rate evaluation, smoothed parameters and band limiting (c) Christian Balkenius 2024
+//
+// Slowly changing values are computed once per control period and interpolated in the
+// audio loop. Parameters can be set from any thread; the audio thread reads them
+// once per control period and smooths the change.
+
+#ifndef CONTROL
+#define CONTROL
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <type_traits>
+
+namespace ikaros
+{
+    const int control_period = 32; // audio samples per control tick
+
+    // Call audio(i, m) for each sample i in [a, b) where m is modulator(j) evaluated at the multiples j of
+    // control_period and interpolated by a cubic through the four nearest control points. The control points
+    // are fixed in absolute sample positions, so a range rendered in parts gives exactly the same values as
+    // when it is rendered at once. The interpolation error falls with the fourth power of the control period;
+    // this matters in the synth where a frequency error is multiplied by the time since the sound started.
+    // When audio takes three arguments it is called as audio(i, m, slope) where slope is the derivative of
+    // the interpolated value per sample.
+
+    template <typename M, typename A>
+    inline void
+    control_rate(int a, int b, M && modulator, A && audio)
+    {
+        if(a >= b)
+            return;
+        const float scale = 1.0f/control_period;
+        int k = a - ((a % control_period) + control_period) % control_period;
+        float m0 = modulator(k-control_period);
+        float m1 = modulator(k);
+        float m2 = modulator(k+control_period);
+        for(; k < b; k += control_period)
+        {
+            float m3 = modulator(k+2*control_period);
+
+            // Lagrange cubic through (-1, m0), (0, m1), (1, m2), (2, m3) evaluated at x in [0, 1)
+
+            float c1 = -m0/3 - m1/2 + m2 - m3/6;
+            float c2 = (m0+m2)/2 - m1;
+            float c3 = (m3-m0)/6 + (m1-m2)/2;
+            int last = std::min(b, k+control_period);
+            for(int i=std::max(a, k); i<last; i++)
+            {
+                float x = float(i-k)*scale;
+                if constexpr (std::is_invocable_v<A, int, float, float>)
+                    audio(i, m1+x*(c1+x*(c2+x*c3)), (c1+x*(2*c2+x*3*c3))*scale);
+                else
+                    audio(i, m1+x*(c1+x*(c2+x*c3)));
+            }
+            m0 = m1;
+            m1 = m2;
+            m2 = m3;
+        }
+    }
+
+
+    // Gain of a partial with the instantaneous frequency freq that keeps it from aliasing: one up to
+    // band_limit_start of the Nyquist frequency and then a smooth fade to zero at the Nyquist frequency.
+    // An oscillator skips the partials with zero gain, so a band limited sound also costs less to compute.
+
+    const float band_limit_start = 0.8f;
+
+    inline float
+    band_limit(float freq, int sample_rate)
+    {
+        float nyquist = 0.5f*sample_rate;
+        float x = std::clamp((nyquist-std::fabs(freq)) / ((1-band_limit_start)*nyquist), 0.0f, 1.0f);
+        return x*x*(3-2*x);
+    }
+
+
+    class smoother // moves a value toward its target once per control tick
+    {
+    public:
+        enum mode { linear, one_pole };
+
+        smoother(float value=0, mode m=linear, int ticks=16) : value_(value), target_(value) { set_mode(m, ticks); } // ticks is the ramp length or time constant
+
+        void
+        set_mode(mode m, int ticks)
+        {
+            mode_ = m;
+            ticks_ = std::max(1, ticks);
+            coefficient_ = 1-std::exp(-1.0f/ticks_);
+        }
+
+        void
+        set_target(float target)
+        {
+            if(target == target_)
+                return;
+            target_ = target;
+            step_ = (target_-value_)/ticks_;
+            remaining_ = mode_ == linear ? ticks_ : 16*ticks_; // a one pole filter is within 1e-7 after 16 time constants
+        }
+
+        void
+        jump(float value) // set without smoothing
+        {
+            value_ = target_ = value;
+            remaining_ = 0;
+        }
+
+        float
+        tick()
+        {
+            if(remaining_ == 0)
+                return value_;
+            if(mode_ == linear)
+                value_ = --remaining_ == 0 ? target_ : value_+step_;
+            else
+            {
+                value_ += (target_-value_)*coefficient_;
+                if(--remaining_ == 0 || std::fabs(target_-value_) <= 1e-6f*std::fabs(target_))
+                {
+                    value_ = target_;
+                    remaining_ = 0;
+                }
+            }
+            return value_;
+        }
+
+        float value() const { return value_; }
+        float target() const { return target_; }
+        bool settled() const { return remaining_ == 0; }
+
+    private:
+        mode    mode_;
+        int     ticks_;
+        float   value_;
+        float   target_;
+        float   step_ = 0;
+        int     remaining_ = 0;
+        float   coefficient_;
+    };
+
+
+    class parameter // automatable value; set() may be called from any thread while the audio thread plays
+    {
+    public:
+        parameter(float value=0, smoother::mode m=smoother::linear, int ticks=16) : target_(value), smoother_(value, m, ticks), start_(value) {}
+
+        void set(float value) { target_.store(value, std::memory_order_relaxed); }
+        float get() const { return target_.load(std::memory_order_relaxed); }
+
+        // Audio thread
+
+        void
+        tick() // start a new control period
+        {
+            start_ = smoother_.value();
+            smoother_.set_target(get());
+            smoother_.tick();
+        }
+
+        void
+        jump() // take the current target at once, e.g. at note on
+        {
+            smoother_.jump(get());
+            start_ = smoother_.value();
+        }
+
+        float start() const { return start_; }              // value at the start of the control period
+        float end() const { return smoother_.value(); }     // value at the end of the control period
+        float at(int i) const { return start_+(end()-start_)*(float(i)*(1.0f/control_period)); } // sample i of the control period
+
+    private:
+        std::atomic<float>  target_;
+        smoother            smoother_;
+        float               start_;
+    };
+};
+
+#endif
@@ -0,0 +1,291 @@
+// dynamics.cc   (c) Christian Balkenius 2024
+//
+// The K-weighting filters are the shelf and high pass of BS.1770 derived for any sample rate from their
+// analog prototypes, with the same constants as the published 48 kHz coefficients. The interpolator of the
+// limiter is a Kaiser windowed sinc in four phases; phase 0 is the sample itself.
+
+#include "dynamics.h"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+
+#include "exceptions.h"
+
+namespace ikaros
+{
+    static const double block_time = 0.1;   // s
+    static const int gate_blocks = 4;       // 400 ms
+    static const double absolute_gate = -70; // LUFS
+    static const double relative_gate = -10; // LU
+
+    static double lufs(double energy) { return -0.691 + 10*std::log10(energy); }
+
+
+    loudness_normalizer::loudness_normalizer(int sample_rate, int channels, float target, float window, float max_gain) :
+        channels_(channels), target_(target), max_gain_(max_gain)
+    {
+        if(sample_rate <= 0 || channels <= 0)
+            throw exception("The loudness normalizer needs a positive sample rate and number of channels.");
+        block_ = std::max(1, int(std::lround(block_time*sample_rate)));
+
+        // High shelf of +4 dB above about 1.5 kHz
+
+        double K = std::tan(M_PI*1681.974450955533/sample_rate);
+        double Q = 0.7071752369554196;
+        double Vh = std::pow(10, 3.999843853973347/20);
+        double Vb = std::pow(Vh, 0.4996667741545416);
+        double a0 = 1 + K/Q + K*K;
+        double shelf[5] = {(Vh + Vb*K/Q + K*K)/a0, 2*(K*K - Vh)/a0, (Vh - Vb*K/Q + K*K)/a0, 2*(K*K - 1)/a0, (1 - K/Q + K*K)/a0};
+
+        // High pass at 38 Hz
+
+        K = std::tan(M_PI*38.13547087602444/sample_rate);
+        Q = 0.5003270373238773;
+        a0 = 1 + K/Q + K*K;
+        double high_pass[5] = {1, -2, 1, 2*(K*K - 1)/a0, (1 - K/Q + K*K)/a0};
+
+        std::copy(shelf, shelf+5, k_[0]);
+        std::copy(high_pass, high_pass+5, k_[1]);
+        state_.assign(4*channels_, 0);
+        delay_.assign(block_*channels_, 0);
+        energy_.assign(std::max(gate_blocks, int(std::lround(window/block_time))), 0);
+        reset();
+    }
+
+
+    void
+    loudness_normalizer::reset()
+    {
+        std::fill(state_.begin(), state_.end(), 0.0);
+        std::fill(delay_.begin(), delay_.end(), 0.0f);
+        std::fill(energy_.begin(), energy_.end(), 0.0);
+        position_ = 0;
+        sum_ = 0;
+        loudness_ = -std::numeric_limits<float>::infinity();
+        from_ = to_ = 1;
+    }
+
+
+    float
+    loudness_normalizer::gain() const
+    {
+        return 20*std::log10(to_);
+    }
+
+
+    void
+    loudness_normalizer::process(float * out, int n)
+    {
+        float step = (to_-from_)/block_;
+        for(int i=0; i<n; i++)
+        {
+            float g = from_ + step*position_;
+            for(int c=0; c<channels_; c++)
+            {
+                float & x = out[i*channels_+c];
+                double y = x;
+                for(int f=0; f<2; f++) // transposed direct form II
+                {
+                    const double * k = k_[f];
+                    double * s = &state_[4*c+2*f];
+                    double z = k[0]*y + s[0];
+                    s[0] = k[1]*y - k[3]*z + s[1];
+                    s[1] = k[2]*y - k[4]*z;
+                    y = z;
+                }
+                sum_ += y*y;
+
+                float & d = delay_[position_*channels_+c];
+                float delayed = d;
+                d = x;
+                x = g*delayed;
+            }
+
+            if(++position_ == block_)
+            {
+                measure();
+                step = (to_-from_)/block_;
+            }
+        }
+    }
+
+
+    void
+    loudness_normalizer::measure() // at the end of a block
+    {
+        std::rotate(energy_.begin(), energy_.begin()+1, energy_.end());
+        energy_.back() = sum_/block_;
+        sum_ = 0;
+        position_ = 0;
+        from_ = to_;
+
+        // Gated mean of the overlapping 400 ms blocks in the window
+
+        int blocks = int(energy_.size())-gate_blocks+1;
+        double total = 0;
+        int count = 0;
+        for(int pass=0; pass<2; pass++)
+        {
+            double gate = pass == 0 ? absolute_gate : std::max(absolute_gate, lufs(total/count)+relative_gate);
+            double gated = 0;
+            int passed = 0;
+            for(int b=0; b<blocks; b++)
+            {
+                double e = 0;
+                for(int j=0; j<gate_blocks; j++)
+                    e += energy_[b+j];
+                e /= gate_blocks;
+                if(e > 0 && lufs(e) > gate)
+                {
+                    gated += e;
+                    passed++;
+                }
+            }
+            if(passed == 0)
+                return; // silence keeps the gain
+            total = gated;
+            count = passed;
+        }
+
+        loudness_ = float(lufs(total/count));
+        to_ = std::pow(10.0f, std::min(max_gain_, target_-loudness_)/20);
+    }
+
+    // Limiter
+
+    static inline int wrap(int i, int n) { return i < n ? i : i-n; } // into [0, n) from [0, 2n)
+
+    static const float *
+    interpolator() // four times oversampling filter with limiter::taps taps; the four phases of each tap are adjacent so they are computed together
+    {
+        const int taps = limiter::taps;
+        static float table[taps][4];
+        static bool done = [] {
+            const double beta = 5;
+            auto i0 = [](double x) { double sum = 1, term = 1; for(int k=1; k<30; k++) { term *= (x/(2*k))*(x/(2*k)); sum += term; } return sum; };
+            table[taps/2-1][0] = 1;
+            for(int p=1; p<4; p++)
+            {
+                double h[taps], sum = 0;
+                for(int j=0; j<taps; j++)
+                {
+                    double t = j-(taps/2-1)-p/4.0;    // from the interpolated point to tap j
+                    double r = t/(taps/2);
+                    h[j] = std::sin(M_PI*t)/(M_PI*t) * (std::fabs(r) < 1 ? i0(beta*std::sqrt(1-r*r))/i0(beta) : 0);
+                    sum += h[j];
+                }
+                for(int j=0; j<taps; j++)
+                    table[j][p] = float(h[j]/sum);
+            }
+            return true;
+        }();
+        (void)done;
+        return &table[0][0];
+    }
+
+
+    limiter::limiter(int sample_rate, int channels, float ceiling, float lookahead, float release) :
+        channels_(channels)
+    {
+        if(sample_rate <= 0 || channels <= 0)
+            throw exception("The limiter needs a positive sample rate and number of channels.");
+        window_ = std::max(1, int(std::lround(lookahead*sample_rate)));
+        ceiling_ = std::pow(10.0f, ceiling/20);
+        release_ = release > 0 ? 1-std::exp(-1/(release*sample_rate)) : 1;
+        history_.assign(2*taps*channels_, 0);
+        delay_.assign(latency()*channels_, 0);
+        minimum_.assign(window_, 1);
+        frame_.assign(window_, 0);
+        average_.assign(window_, 1);
+        interpolator();
+        reset();
+    }
+
+
+    void
+    limiter::reset()
+    {
+        std::fill(history_.begin(), history_.end(), 0.0f);
+        std::fill(delay_.begin(), delay_.end(), 0.0f);
+        std::fill(average_.begin(), average_.end(), 1.0f);
+        head_ = 0;
+        delay_head_ = 0;
+        first_ = 0;
+        count_ = 0;
+        oldest_ = 0;
+        sum_ = window_;
+        held_ = 1;
+        gain_ = 1;
+        frames_ = 0;
+    }
+
+
+    float
+    limiter::peak(const float * table)
+    {
+        float p = 0;
+        for(int c=0; c<channels_; c++)
+        {
+            const float * x = &history_[2*taps*c+head_];  // oldest first
+            float s[4] = {0};
+            for(int j=0; j<taps; j++)
+                for(int phase=0; phase<4; phase++)
+                    s[phase] += table[4*j+phase]*x[j];
+            for(int phase=0; phase<4; phase++)
+                p = std::max(p, std::fabs(s[phase]));
+        }
+        return p;
+    }
+
+
+    void
+    limiter::process(float * out, int n)
+    {
+        int length = latency();
+        const float * table = interpolator();
+        const float scale = 1.0f/window_;
+        for(int i=0; i<n; i++)
+        {
+            float * frame = out+i*channels_;
+            for(int c=0; c<channels_; c++)
+                history_[2*taps*c+head_] = history_[2*taps*c+head_+taps] = frame[c];
+            head_ = wrap(head_+1, taps);
+
+            float p = peak(table);
+            float required = p > ceiling_ ? ceiling_/p : 1;
+
+            // Sliding minimum over the window
+
+            if(count_ > 0 && frame_[first_] <= frames_-window_)
+            {
+                first_ = wrap(first_+1, window_);
+                count_--;
+            }
+            while(count_ > 0 && minimum_[wrap(first_+count_-1, window_)] >= required)
+                count_--;
+            minimum_[wrap(first_+count_, window_)] = required;
+            frame_[wrap(first_+count_, window_)] = frames_;
+            count_++;
+            frames_++;
+
+            // Release, then the moving average that ends on the delayed frame
+
+            held_ = std::min(minimum_[first_], held_ + (1-held_)*release_);
+            float & oldest = average_[oldest_];
+            sum_ += held_-oldest;
+            oldest = held_;
+            oldest_ = wrap(oldest_+1, window_);
+            gain_ = std::min(1.0f, float(sum_)*scale);
+
+            float * delayed = &delay_[delay_head_*channels_];
+            for(int c=0; c<channels_; c++)
+            {
+                float x = frame[c];
+                frame[c] = gain_*delayed[c];
+                delayed[c] = x;
+            }
+            delay_head_ = wrap(delay_head_+1, length);
+        }
+    }
+};
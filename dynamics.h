@@ -0,0 +1,101 @@
+// dynamics.h - streaming loudness normalization and lookahead peak limiting (c) Christian Balkenius 2024
+//
+// Both stages process interleaved frames in place as they stream past, so a mix can be kept at a steady
+// level and below full scale without a second pass over a finished buffer. They delay the signal by a
+// fixed number of frames, allocate all memory when they are constructed and can run in an audio callback.
+//
+//      ikaros::loudness_normalizer normalizer(44100, 2);   // -16 LUFS
+//      ikaros::limiter limiter(44100, 2);                  // -1 dBTP
+//      normalizer.process(out, n);
+//      limiter.process(out, n);
+//
+// The normalizer measures the loudness as in ITU-R BS.1770: the channels are K-weighted, the mean square
+// is summed over 100 ms blocks, and the loudness of a sliding window is the mean of its 400 ms blocks that
+// pass the absolute gate at -70 LUFS and the relative gate 10 LU below their mean. Once per block the gain
+// moves to the difference between the target and the measured loudness, ramped over the next block. The
+// audio is delayed by one block so that the ramp ends on the block that was measured. Silence does not
+// change the gain, and the gain never rises above max_gain.
+//
+// The limiter finds the peak of each frame on all channels, including the peaks between the samples
+// from a four times oversampled interpolation, and computes the gain that keeps the frame below the
+// ceiling. The smallest gain over the lookahead window is smoothed by a moving average of the same
+// length, which ends on the delayed frame, so the gain is already down when the peak leaves the limiter
+// and no sample goes above the ceiling by more than rounding. The gain then recovers with the release time constant.
+
+#ifndef DYNAMICS
+#define DYNAMICS
+
+#include <cmath>
+#include <vector>
+
+namespace ikaros
+{
+    class loudness_normalizer
+    {
+    public:
+        loudness_normalizer(int sample_rate, int channels=1, float target=-16, float window=3, float max_gain=12); // target in LUFS, window in seconds, max_gain in dB
+
+        void process(float * out, int n);  // n frames of interleaved channels, in place
+        int latency() const { return block_; }  // frames
+        void reset();
+
+        float loudness() const { return loudness_; }   // LUFS over the window; -inf before the first block that passes the gates
+        float gain() const;                             // dB at the end of the current ramp
+
+    private:
+        void measure();
+
+        int                     channels_;
+        int                     block_;         // frames in 100 ms
+        float                   target_;
+        float                   max_gain_;      // dB
+        double                  k_[2][5];       // K-weighting biquads: b0, b1, b2, a1, a2
+        std::vector<double>     state_;         // two biquads of two samples for each channel
+        std::vector<float>      delay_;         // one block of frames
+        std::vector<double>     energy_;        // mean square of the blocks in the window, oldest first
+        int                     position_;      // frame in the current block
+        double                  sum_;           // weighted square sum of the current block
+        float                   loudness_;
+        float                   from_;          // linear gain ramp over the current block
+        float                   to_;
+    };
+
+
+    class limiter
+    {
+    public:
+        static const int taps = 12;         // of each phase of the interpolator
+
+        limiter(int sample_rate, int channels=1, float ceiling=-1, float lookahead=0.005f, float release=0.05f); // ceiling in dBTP, times in seconds
+
+        void process(float * out, int n);  // n frames of interleaved channels, in place
+        int latency() const { return taps/2 + window_-1; } // frames
+        void reset();
+
+        float gain() const { return 20*std::log10(gain_); } // dB applied to the last frame
+
+    private:
+        float peak(const float * table);    // of the frame taps/2 frames back, from the history
+
+        int                     channels_;
+        int                     window_;    // lookahead in frames
+        float                   ceiling_;   // linear
+        float                   release_;   // coefficient per frame
+        std::vector<float>      history_;   // last taps samples of each channel for the interpolator, written twice so that they are contiguous from head_
+        int                     head_;
+        std::vector<float>      delay_;     // latency() frames, circular
+        int                     delay_head_;
+        std::vector<float>      minimum_;   // required gains in increasing order with their frame numbers: sliding minimum
+        std::vector<long>       frame_;
+        int                     first_;     // circular queue of count_ entries in minimum_ and frame_
+        int                     count_;
+        std::vector<float>      average_;   // last window_ gains after the release, circular
+        int                     oldest_;
+        double                  sum_;
+        float                   held_;      // gain after the release
+        float                   gain_;
+        long                    frames_;
+    };
+};
+
+#endif
@@ -0,0 +1,243 @@
+// envelope.cc   (c) Christian Balkenius 2024
+
+#include "envelope.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ikaros
+{
+    // Exponential segments approach a point beyond their target so that they reach it in finite time.
+    // The overshoot is a fraction of the segment height; small values give sharper curves.
+
+    static const float attack_ratio = 0.3f;
+    static const float decay_ratio = 0.0001f;
+
+    envelope::envelope(float sample_rate) : sample_rate_(sample_rate)
+    {
+    }
+
+
+    void
+    envelope::set(float attack_time, float decay_time, float sustain_level, float release_time, curve c)
+    {
+        set_attack(attack_time, c);
+        set_decay(decay_time, c);
+        set_sustain(sustain_level);
+        set_release(release_time, c);
+    }
+
+
+    void
+    envelope::set_attack(float time, curve c)
+    {
+        attack_time_ = std::max(0.0f, time);
+        attack_curve_ = c;
+    }
+
+
+    void
+    envelope::set_decay(float time, curve c)
+    {
+        decay_time_ = std::max(0.0f, time);
+        decay_curve_ = c;
+    }
+
+
+    void
+    envelope::set_sustain(float level)
+    {
+        sustain_ = level;
+        if(stage_ == sustain)
+            level_ = sustain_;
+    }
+
+
+    void
+    envelope::set_release(float time, curve c)
+    {
+        release_time_ = std::max(0.0f, time);
+        release_curve_ = c;
+    }
+
+
+    void
+    envelope::set_sample_rate(float sample_rate)
+    {
+        sample_rate_ = sample_rate;
+    }
+
+
+    long
+    envelope::to_samples(float time) const
+    {
+        return std::lround(time*sample_rate_);
+    }
+
+
+    void
+    envelope::note_on(int gate)
+    {
+        gate_ = gate;
+        enter(attack);
+        if(gate_ == 0)
+        {
+            gate_ = -1;
+            note_off();
+        }
+    }
+
+
+    void
+    envelope::note_off()
+    {
+        gate_ = -1;
+        if(stage_ != idle && stage_ != release)
+            enter(release);
+    }
+
+
+    void
+    envelope::reset()
+    {
+        gate_ = -1;
+        enter(idle);
+    }
+
+
+    void
+    envelope::begin_segment(float target, long count, curve c, float ratio)
+    {
+        target_ = target;
+        remaining_ = count;
+        curve_ = c;
+        if(count <= 0)
+            return;
+
+        if(c == linear)
+        {
+            start_ = level_;
+            step_ = (target-level_)/count;
+            position_ = 0;
+        }
+        else
+        {
+            float asymptote = target+(target-level_)*ratio;
+            coefficient_ = std::pow(ratio/(1+ratio), 1.0f/count);
+            offset_ = asymptote*(1-coefficient_);
+        }
+    }
+
+
+    void
+    envelope::enter(stage s)
+    {
+        stage_ = s;
+        switch(s)
+        {
+            case attack:    begin_segment(1, std::lround(to_samples(attack_time_)*std::clamp(1-level_, 0.0f, 1.0f)), attack_curve_, attack_ratio); break; // constant slope when retriggered
+            case decay:     begin_segment(sustain_, to_samples(decay_time_), decay_curve_, decay_ratio); break;
+            case release:   begin_segment(0, to_samples(release_time_), release_curve_, decay_ratio); break;
+            case sustain:   level_ = sustain_; remaining_ = -1; return;
+            case idle:      level_ = 0; remaining_ = -1; return;
+        }
+        if(remaining_ <= 0)
+            end_segment();
+    }
+
+
+    void
+    envelope::end_segment()
+    {
+        level_ = target_;
+        switch(stage_)
+        {
+            case attack:    enter(decay); break;
+            case decay:     enter(sustain); break;
+            case release:   enter(idle); break;
+            default:        break;
+        }
+    }
+
+
+    template <bool multiply>
+    void
+    envelope::render(float * out, int n)
+    {
+        while(n > 0)
+        {
+            long span = n;
+            if(remaining_ >= 0)
+                span = std::min(span, remaining_);
+            if(gate_ >= 0)
+                span = std::min(span, gate_);
+
+            if(remaining_ < 0) // sustain or idle
+            {
+                float v = level_;
+                for(long i=0; i<span; i++)
+                    if constexpr(multiply) out[i] *= v; else out[i] = v;
+            }
+            else if(curve_ == linear)
+            {
+                float a = start_;
+                float b = step_;
+                float p = float(position_);
+                for(long i=0; i<span; i++)
+                    if constexpr(multiply) out[i] *= a+b*(p+i); else out[i] = a+b*(p+i);
+                position_ += span;
+                level_ = start_+step_*position_;
+            }
+            else
+            {
+                float v = level_;
+                float c = coefficient_;
+                float d = offset_;
+                for(long i=0; i<span; i++)
+                {
+                    if constexpr(multiply) out[i] *= v; else out[i] = v;
+                    v = v*c+d;
+                }
+                level_ = v;
+            }
+
+            out += span;
+            n -= span;
+            if(remaining_ >= 0)
+            {
+                remaining_ -= span;
+                if(remaining_ == 0)
+                    end_segment();
+            }
+            if(gate_ >= 0)
+            {
+                gate_ -= span;
+                if(gate_ == 0)
+                    note_off();
+            }
+        }
+    }
+
+
+    float
+    envelope::next()
+    {
+        float v;
+        render<false>(&v, 1);
+        return v;
+    }
+
+
+    void
+    envelope::process(float * out, int n)
+    {
+        render<false>(out, n);
+    }
+
+
+    void
+    envelope::apply(float * samples, int n)
+    {
+        render<true>(samples, n);
+    }
+};
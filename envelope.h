@@ -0,0 +1,68 @@
+// envelope.h - ADSR envelope generator (c) Christian Balkenius 2024
+//
+// The envelope steps incrementally from sample to sample. Block processing splits the output into
+// spans that lie within a single segment, and each span is filled by a tight loop with no per-sample branching.
+
+#ifndef ENVELOPE
+#define ENVELOPE
+
+namespace ikaros
+{
+    class envelope
+    {
+    public:
+        enum curve { linear, exponential };
+        enum stage { idle, attack, decay, sustain, release };
+
+        envelope(float sample_rate=44100);
+
+        void set(float attack_time, float decay_time, float sustain_level, float release_time, curve c=linear); // times in seconds
+        void set_attack(float time, curve c=linear);
+        void set_decay(float time, curve c=linear);
+        void set_sustain(float level);
+        void set_release(float time, curve c=linear);
+        void set_sample_rate(float sample_rate);
+
+        void note_on(int gate=-1);  // (re)start the attack from the current level; note_off follows after gate samples unless gate < 0
+        void note_off();            // release from the current level
+        void reset();               // go to idle at level 0
+
+        float next();                           // value for the next sample
+        void process(float * out, int n);       // write the next n values
+        void apply(float * samples, int n);     // multiply n samples by the next n values
+
+        stage get_stage() const { return stage_; }
+        float level() const { return level_; }  // value of the next sample
+        bool active() const { return stage_ != idle; }
+
+    private:
+        template <bool multiply> void render(float * out, int n);
+        void enter(stage s);
+        void begin_segment(float target, long count, curve c, float ratio);
+        void end_segment();
+        long to_samples(float time) const;
+
+        float   sample_rate_;
+        float   attack_time_ = 0.01f;
+        float   decay_time_ = 0;
+        float   sustain_ = 1;
+        float   release_time_ = 0.1f;
+        curve   attack_curve_ = linear;
+        curve   decay_curve_ = linear;
+        curve   release_curve_ = linear;
+
+        stage   stage_ = idle;
+        float   level_ = 0;
+        float   target_ = 0;
+        long    remaining_ = -1;    // samples left in the current segment; -1 for sustain and idle
+        long    gate_ = -1;         // samples left until note_off; -1 if none
+        curve   curve_ = linear;
+        float   start_ = 0;         // linear segment: level = start_ + step_*position_
+        float   step_ = 0;
+        long    position_ = 0;
+        float   coefficient_ = 1;   // exponential segment: level = level*coefficient_ + offset_
+        float   offset_ = 0;
+    };
+};
+
+#endif
@@ -0,0 +1,265 @@
+// golden.cc - regression test of the rendered sounds against stored reference buffers
+//
+//      golden_test [--update] [--dir <references>] [--out <directory>]
+//
+// Every generator of R2D2Synth, the surprised sound also at 2 s, two of them also resampled and three band
+// limited at 16 kHz, and every patch in patches/, two of them also at 16 kHz, is rendered with a fixed seed and
+// compared with its reference in golden/ by the largest absolute difference, the signal to noise ratio, and the
+// log-spectral distance. A sound fails when any measure is outside its tolerance, and the program then
+// exits with status 1. --update writes new references instead; --out also writes the rendered sounds.
+// No audio device is used, so the test runs headless.
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "matrix.h"
+#include "matrix_io.h"
+#include "patch.h"
+#include "r2d2synth.h"
+#include "resampler.h"
+
+using namespace ikaros;
+
+const int sample_rate = 44100;
+const float duration = 0.5f;    // of each rendered sound
+const uint64_t seed = 1234;
+
+
+struct tolerance
+{
+    float   max_abs = 2e-3f;        // largest absolute difference
+    float   min_snr_db = 60;        // reference power over difference power
+    float   max_lsd_db = 0.5f;      // mean log-spectral distance over the frames
+};
+
+
+struct golden_case
+{
+    std::string                 name;
+    std::function<matrix()>     render;
+    tolerance                   limits;
+};
+
+
+struct metrics
+{
+    float   max_abs = 0;
+    float   snr_db = INFINITY;
+    float   lsd_db = 0;
+};
+
+
+static void
+fft(std::vector<std::complex<float>> & x) // in place, radix 2; the size must be a power of two
+{
+    int n = x.size();
+    for(int i=1, j=0; i<n; i++)
+    {
+        int bit = n >> 1;
+        for(; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j)
+            std::swap(x[i], x[j]);
+    }
+    for(int length=2; length<=n; length<<=1)
+    {
+        std::complex<float> w = std::polar(1.0f, float(-2*M_PI/length));
+        for(int i=0; i<n; i+=length)
+        {
+            std::complex<float> wk = 1;
+            for(int k=0; k<length/2; k++)
+            {
+                std::complex<float> u = x[i+k];
+                std::complex<float> v = x[i+k+length/2] * wk;
+                x[i+k] = u+v;
+                x[i+k+length/2] = u-v;
+                wk *= w;
+            }
+        }
+    }
+}
+
+
+static std::vector<float>
+magnitudes(const float * x, int n) // windowed magnitude spectrum of n samples
+{
+    std::vector<std::complex<float>> s(n);
+    for(int i=0; i<n; i++)
+        s[i] = x[i] * 0.5f * (1 - std::cos(2 * float(M_PI) * i / (n-1)));
+    fft(s);
+    std::vector<float> m(n/2+1);
+    for(int k=0; k<=n/2; k++)
+        m[k] = std::abs(s[k]);
+    return m;
+}
+
+
+static metrics
+compare(matrix & sound, matrix & reference)
+{
+    metrics r;
+    int n = sound.size();
+    const float * x = std::as_const(sound).data();
+    const float * y = std::as_const(reference).data();
+
+    double signal = 0;
+    double noise = 0;
+    for(int i=0; i<n; i++)
+    {
+        float d = x[i]-y[i];
+        r.max_abs = std::max(r.max_abs, std::fabs(d));
+        signal += double(y[i])*y[i];
+        noise += double(d)*d;
+    }
+    if(noise > 0)
+        r.snr_db = 10 * std::log10(signal / noise);
+
+    // Log-spectral distance over half-overlapping frames; bins more than 60 dB below the peak of the frame are ignored
+
+    const int frame = 1024;
+    int frames = 0;
+    double lsd = 0;
+    for(int start=0; start+frame <= n; start+=frame/2)
+    {
+        std::vector<float> a = magnitudes(x+start, frame);
+        std::vector<float> b = magnitudes(y+start, frame);
+        float floor = 1e-3f * *std::max_element(b.begin(), b.end()) + 1e-9f;
+        double sum = 0;
+        for(int k=0; k<a.size(); k++)
+        {
+            double d = 20 * std::log10((a[k]+floor) / (b[k]+floor));
+            sum += d*d;
+        }
+        lsd += std::sqrt(sum / a.size());
+        frames++;
+    }
+    r.lsd_db = frames > 0 ? lsd / frames : 0;
+    return r;
+}
+
+
+static std::vector<golden_case>
+cases()
+{
+    std::vector<golden_case> c;
+    tolerance sweep = {5e-3f, 55, 0.5f}; // long frequency sweeps accumulate rounding in the phase
+
+    auto generator = [&](const std::string & name, std::function<matrix(R2D2Synth &)> f, tolerance limits=tolerance())
+    {
+        c.push_back({name, [f]() { R2D2Synth synth(sample_rate, seed); return f(synth); }, limits});
+    };
+
+    auto band_limited = [&](const std::string & name, int rate, std::function<matrix(R2D2Synth &)> f, tolerance limits=tolerance())
+    {
+        c.push_back({name, [rate, f]() { R2D2Synth synth(rate, seed); synth.setBandLimited(); return f(synth); }, limits});
+    };
+
+    auto patch_file = [&](const std::string & name, tolerance limits=tolerance(), int rate=sample_rate)
+    {
+        std::string suffix = rate == sample_rate ? "" : "_"+std::to_string(rate/1000)+"k";
+        c.push_back({"patch_"+name+suffix, [name, rate]() { return patch::load("patches/"+name+".patch", rate).render(duration, seed); }, limits});
+    };
+
+    generator("sound", [](R2D2Synth & s) { return s.generateSound(duration); });
+    generator("happy", [](R2D2Synth & s) { return s.generateHappySound(duration); });
+    generator("surprised", [](R2D2Synth & s) { return s.generateSurprisedSound(duration); }, sweep);
+    generator("surprised_2s", [](R2D2Synth & s) { return s.generateSurprisedSound(2); }, sweep); // the phase error of the vibrato grows with time
+    generator("wow", [](R2D2Synth & s) { return s.generateWowSound(duration); });
+    generator("protest", [](R2D2Synth & s) { return s.generateProtestSound(duration); });
+    generator("indignation", [](R2D2Synth & s) { return s.generateIndignationSound(duration); });
+    generator("laughter", [](R2D2Synth & s) { return s.generateLaughterSound(duration, 1); });
+    generator("titter", [](R2D2Synth & s) { return s.generateLaughterSound(duration, 0.1f); });
+    generator("happy_16k", [](R2D2Synth & s) { matrix m = s.generateHappySound(duration); return resample(m, sample_rate, 16000); });
+    generator("wow_48k", [](R2D2Synth & s) { matrix m = s.generateWowSound(duration); return resample(m, sample_rate, 48000); });
+    band_limited("sound_16k", 16000, [](R2D2Synth & s) { return s.generateSound(duration); });
+    band_limited("wow_16k", 16000, [](R2D2Synth & s) { return s.generateWowSound(duration); });
+    band_limited("indignation_16k", 16000, [](R2D2Synth & s) { return s.generateIndignationSound(duration); });
+
+    patch_file("chirp");
+    patch_file("happy");
+    patch_file("indignation");
+    patch_file("laughter");
+    patch_file("protest");
+    patch_file("surprised", sweep);
+    patch_file("wow");
+    patch_file("happy", tolerance(), 16000);
+    patch_file("wow", tolerance(), 16000);
+
+    return c;
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    bool update = false;
+    std::string dir = "golden";
+    std::string out;
+    for(int i=1; i<argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--update")
+            update = true;
+        else if(arg == "--dir" && i+1 < argc)
+            dir = argv[++i];
+        else if(arg == "--out" && i+1 < argc)
+            out = argv[++i];
+        else
+        {
+            std::cerr << "Usage: golden_test [--update] [--dir <references>] [--out <directory>]" << std::endl;
+            return 2;
+        }
+    }
+
+    int failures = 0;
+    for(auto & c : cases())
+    {
+        matrix sound = c.render();
+        std::string reference_file = dir+"/"+c.name+".ikmx";
+        if(!out.empty())
+            save_binary(out+"/"+c.name+".ikmx", sound);
+
+        if(update)
+        {
+            save_binary(reference_file, sound);
+            std::printf("%-20s written\n", c.name.c_str());
+            continue;
+        }
+
+        matrix reference;
+        try
+        {
+            reference = load_binary(reference_file);
+        }
+        catch(const std::exception & e)
+        {
+            std::printf("%-20s FAIL  %s\n", c.name.c_str(), e.what());
+            failures++;
+            continue;
+        }
+
+        if(reference.size() != sound.size())
+        {
+            std::printf("%-20s FAIL  %d samples instead of %d\n", c.name.c_str(), sound.size(), reference.size());
+            failures++;
+            continue;
+        }
+
+        metrics m = compare(sound, reference);
+        bool pass = m.max_abs <= c.limits.max_abs && m.snr_db >= c.limits.min_snr_db && m.lsd_db <= c.limits.max_lsd_db;
+        std::printf("%-20s %s  max abs %.3g, SNR %.1f dB, LSD %.3f dB\n", c.name.c_str(), pass ? "ok  " : "FAIL", m.max_abs, m.snr_db, m.lsd_db);
+        failures += !pass;
+    }
+
+    if(!update)
+        std::printf("%d failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}
@@ -3,11 +3,19 @@
 #include <cmath>
 #include <atomic>
 #include "r2d2synth.h"
+#include "sequencer.h"
+#include "alloc.h"
+#include "monitor.h"
+#include "trace.h"
+#include "pcm.h"
+#include "dynamics.h"
 
 const int SAMPLE_RATE = 44100;
 const int BUFFER_SIZE = 4096; // Increased buffer size
 const int NUM_BUFFERS = 3;    // Use multiple buffers
 
+ikaros::audio_monitor monitor(SAMPLE_RATE); // timing of the callbacks against their deadlines
+
 struct AudioData {
     const float* buffer;
     int size;
@@ -16,6 +24,9 @@ struct AudioData {
 };
 
 void audioQueueOutputCallback(void* inUserData, AudioQueueRef inAQ, AudioQueueBufferRef inBuffer) {
+    TRACE_SCOPE("audioQueueOutputCallback");
+    ikaros::no_alloc_scope guard("audioQueueOutputCallback");
+    int64_t begin = monitor.begin();
     AudioData* audioData = static_cast<AudioData*>(inUserData);
     int remainingFrames = audioData->size - audioData->currentPosition;
     int framesToCopy = std::min(remainingFrames, static_cast<int>(inBuffer->mAudioDataBytesCapacity / sizeof(float)));
@@ -26,6 +37,7 @@ void audioQueueOutputCallback(void* inUserData, AudioQueueRef inAQ, AudioQueueBu
                framesToCopy * sizeof(float));
         inBuffer->mAudioDataByteSize = framesToCopy * sizeof(float);
         audioData->currentPosition += framesToCopy;
+        monitor.end(begin, framesToCopy);
     } else {
         inBuffer->mAudioDataByteSize = 0;
         audioData->isFinished = true;
@@ -48,6 +60,7 @@ void playMatrixAsAudio(ikaros::matrix& audioMatrix) {
 
     AudioQueueRef queue;
     AudioData audioData = { audioMatrix.data(), static_cast<int>(audioMatrix.size()), 0, false };
+    ikaros::trace_reserve(1); // for the callback thread of the queue
     AudioQueueNewOutput(&asbd, audioQueueOutputCallback, &audioData, NULL, NULL, 0, &queue);
 
     for (int i = 0; i < NUM_BUFFERS; ++i) {
@@ -57,6 +70,7 @@ void playMatrixAsAudio(ikaros::matrix& audioMatrix) {
     }
 
     AudioQueueStart(queue, NULL);
+    monitor.start();
 
     while (!audioData.isFinished) {
         usleep(10000); // Sleep for 10ms
@@ -65,9 +79,109 @@ void playMatrixAsAudio(ikaros::matrix& audioMatrix) {
     usleep(500000); // Wait an additional 500ms to ensure all audio is played
 
     AudioQueueStop(queue, true);
+    monitor.stop();
     AudioQueueDispose(queue, true);
 }
 
+struct SequencerData {
+    ikaros::sequencer* sequencer;
+    std::atomic<bool> isFinished;
+    bool integer;                   // 16-bit PCM instead of float
+    int channels;                   // interleaved
+    std::vector<float> block;       // float samples before the conversion to PCM
+    ikaros::pcm_dither dither;
+    ikaros::loudness_normalizer* normalizer;
+    ikaros::limiter* limiter;
+    int tail;                       // frames still in the normalizer and the limiter when the sequencer is idle
+};
+
+void sequencerOutputCallback(void* inUserData, AudioQueueRef inAQ, AudioQueueBufferRef inBuffer) {
+    TRACE_SCOPE("sequencerOutputCallback");
+    ikaros::no_alloc_scope guard("sequencerOutputCallback");
+    int64_t begin = monitor.begin();
+    SequencerData* sequencerData = static_cast<SequencerData*>(inUserData);
+    int bytesPerFrame = sequencerData->channels * (sequencerData->integer ? sizeof(int16_t) : sizeof(float));
+    int frames = static_cast<int>(inBuffer->mAudioDataBytesCapacity / bytesPerFrame);
+
+    float* samples = sequencerData->integer ? sequencerData->block.data() : static_cast<float*>(inBuffer->mAudioData);
+    sequencerData->sequencer->process(samples, frames);
+    sequencerData->normalizer->process(samples, frames);
+    sequencerData->limiter->process(samples, frames);
+    if (sequencerData->integer)
+        ikaros::pcm_encode(samples, inBuffer->mAudioData, frames * sequencerData->channels, ikaros::pcm_format::s16, &sequencerData->dither);
+    inBuffer->mAudioDataByteSize = frames * bytesPerFrame;
+    monitor.end(begin, frames);
+    if (sequencerData->sequencer->idle() && (sequencerData->tail -= frames) <= 0)
+        sequencerData->isFinished = true;
+
+    AudioQueueEnqueueBuffer(inAQ, inBuffer, 0, NULL);
+}
+
+// Renders the sequencer in the audio callback until all scheduled sounds have ended. Events posted
+// while it plays take effect at their sample. With integer, the output is dithered 16-bit PCM, which
+// halves the size of the buffers. There is one interleaved channel for each speaker of the mixer.
+// The mix is normalized to -16 LUFS and limited to -1 dBTP as it streams, which delays it by about 0.1 s.
+
+void playSequencer(ikaros::sequencer& sequencer, bool integer = false) {
+    int channels = sequencer.voices().channels();
+    int bytesPerSample = integer ? sizeof(int16_t) : sizeof(float);
+    int bytesPerFrame = channels * bytesPerSample;
+    AudioStreamBasicDescription asbd;
+    memset(&asbd, 0, sizeof(asbd));
+    asbd.mSampleRate = SAMPLE_RATE;
+    asbd.mFormatID = kAudioFormatLinearPCM;
+    asbd.mFormatFlags = (integer ? kAudioFormatFlagIsSignedInteger : kAudioFormatFlagIsFloat) | kAudioFormatFlagIsPacked;
+    asbd.mBitsPerChannel = 8 * bytesPerSample;
+    asbd.mChannelsPerFrame = channels;
+    asbd.mFramesPerPacket = 1;
+    asbd.mBytesPerFrame = bytesPerFrame;
+    asbd.mBytesPerPacket = bytesPerFrame;
+
+    AudioQueueRef queue;
+    SequencerData sequencerData;
+    sequencerData.sequencer = &sequencer;
+    sequencerData.isFinished = false;
+    sequencerData.integer = integer;
+    sequencerData.channels = channels;
+    sequencerData.block.resize(integer ? BUFFER_SIZE * channels : 0);
+    ikaros::loudness_normalizer normalizer(SAMPLE_RATE, channels);
+    ikaros::limiter limiter(SAMPLE_RATE, channels);
+    sequencerData.normalizer = &normalizer;
+    sequencerData.limiter = &limiter;
+    sequencerData.tail = normalizer.latency() + limiter.latency();
+    ikaros::trace_reserve(1);
+    AudioQueueNewOutput(&asbd, sequencerOutputCallback, &sequencerData, NULL, NULL, 0, &queue);
+
+    for (int i = 0; i < NUM_BUFFERS; ++i) {
+        AudioQueueBufferRef buffer;
+        AudioQueueAllocateBuffer(queue, BUFFER_SIZE * bytesPerFrame, &buffer);
+        sequencerOutputCallback(&sequencerData, queue, buffer);
+    }
+
+    AudioQueueStart(queue, NULL);
+    monitor.start();
+
+    while (!sequencerData.isFinished) {
+        usleep(10000);
+    }
+
+    usleep(500000);
+
+    AudioQueueStop(queue, true);
+    monitor.stop();
+    AudioQueueDispose(queue, true);
+}
+
+void printMonitor() {
+    ikaros::audio_stats stats = monitor.stats();
+    std::cout << "Callbacks: " << stats.callbacks
+              << ", mean " << stats.mean_ms << " ms, max " << stats.max_ms << " ms"
+              << " of " << stats.deadline_ms << " ms deadline" << std::endl;
+    std::cout << "Load: median " << 100 * stats.load(0.5) << "%, 99th percentile " << 100 * stats.load(0.99) << "%" << std::endl;
+    std::cout << "Deadline misses: " << stats.misses << ", underruns: " << stats.underruns << std::endl;
+    std::cout << "Longest voice render: " << stats.voice_max_ms << " ms" << std::endl;
+}
+
 ikaros::matrix generateSineWave(int duration, float frequency) {
     int numSamples = duration * SAMPLE_RATE;
     ikaros::matrix sineWave(numSamples);
@@ -143,6 +257,25 @@ int main() {
     std::cout << "Playing hearty laugh (intensity 1.0) R2D2 sound..." << std::endl;
     ikaros::matrix laugh = synth.generateLaughterSound(1.5f, 1.0f);
     playMatrixAsAudio(laugh);
+    usleep(500);
+
+    std::cout << "Playing a crowd of 64 R2D2 voices around the listener in 16-bit stereo..." << std::endl;
+    const char* patches[] = { "happy", "surprised", "wow", "protest", "indignation", "laughter", "chirp" };
+    ikaros::sequencer crowd;
+    crowd.voices().set_monitor(&monitor);
+    crowd.voices().set_speakers({-30, 30});
+    for (int i = 0; i < 64; ++i) { // one new voice every 50 ms, each a little further around and away
+        long voice = crowd.trigger(i * SAMPLE_RATE / 20, ikaros::patch::load(std::string("patches/") + patches[i % 7] + ".patch", SAMPLE_RATE), 0.25f, 0, i);
+        crowd.set_position(i * SAMPLE_RATE / 20, voice, i * 45.0f, 1 + i % 3);
+    }
+    playSequencer(crowd, true);
+
+    printMonitor();
+
+#ifdef IKAROS_TRACE
+    ikaros::trace_write("trace.json");
+    std::cout << "Trace written to trace.json" << std::endl;
+#endif
 
 
     return 0;
@@ -2,10 +2,98 @@
 
 #include "matrix.h"
 
+#include <charconv>
+#include <cstdlib>
 
 namespace ikaros {
 
+    // Parse a matrix string in a single pass without temporary strings.
+    // A pre-scan counts the separators to size the matrix before the values are written in place.
 
+    void
+    matrix::parse(const std::string & data_string)
+    {
+        const char * begin = data_string.c_str();
+        const char * end = begin + data_string.size();
 
-}
+        auto blank = [](char c) { return c==' ' || c=='\t' || c=='\n' || c=='\r'; };
+
+        const char * last = end; // ignore a final ';'
+        while(last > begin && blank(last[-1]))
+            last--;
+        if(last > begin && last[-1] == ';')
+            end = last-1;
+
+        int rows = 1;
+        int cols = 1;
+        for(const char * p=begin; p<end; p++)
+            if(*p == ';')
+                rows++;
+            else if(*p == ',' && rows == 1)
+                cols++;
+
+        if(rows == 1)
+            realloc(std::vector<int>{cols});
+        else
+            realloc(std::vector<int>{rows, cols});
+
+        int line = 1;
+        const char * line_start = begin;
+        const char * p = begin;
+
+        auto fail = [&](const std::string & what)
+        {
+            throw std::invalid_argument("Invalid matrix string at line "+std::to_string(line)+", column "+std::to_string(p-line_start+1)+": "+what);
+        };
 
+        auto skip_blanks = [&]()
+        {
+            for(; p<end && blank(*p); p++)
+                if(*p == '\n')
+                {
+                    line++;
+                    line_start = p+1;
+                }
+        };
+
+        float * out = data_->data();
+        for(int j=0; j<rows; j++)
+            for(int i=0; i<cols; i++)
+            {
+                skip_blanks();
+                if(p < end && *p == '+') // from_chars does not accept a plus sign
+                    p++;
+                #if defined(__cpp_lib_to_chars)
+                auto [next, ec] = std::from_chars(p, end, *out++);
+                if(ec != std::errc() || next == p)
+                    fail("expected a number");
+                p = next;
+                #else
+                char * next;
+                *out++ = std::strtof(p, &next);
+                if(next == p || next > end)
+                    fail("expected a number");
+                p = next;
+                #endif
+                skip_blanks();
+
+                if(i < cols-1)
+                {
+                    if(p == end || *p != ',')
+                        fail(p == end || *p == ';' ? "too few values in row "+std::to_string(j) : "expected ','");
+                    p++;
+                }
+                else if(j < rows-1)
+                {
+                    if(p == end || *p != ';')
+                        fail(p < end && *p == ',' ? "too many values in row "+std::to_string(j) : "expected ';'");
+                    p++;
+                }
+            }
+
+        skip_blanks();
+        if(p != end)
+            fail(*p == ',' ? "too many values in row "+std::to_string(rows-1) : "unexpected character");
+    }
+
+}
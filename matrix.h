@@ -16,17 +16,22 @@
 #include <iterator>
 #include <numeric>
 #include <limits>
+#include <cstring>
 
-//#include <cblas.h>
-
+#ifdef __APPLE__
 #define ACCELERATE_NEW_LAPACK
 #include <Accelerate/Accelerate.h>
+#else
+#include <cblas.h>
+#endif
 
 // #define NO_MATRIX_CHECKS   // Define to remove checks of matrix size and index ranges
 
 #include "exceptions.h"
 #include "utilities.h"
 #include "range.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 namespace ikaros
 {
@@ -56,6 +61,8 @@ namespace ikaros
         int size_;                                      // the size of the data, is different from data_.size() for submatrices
         std::string name_;                              // name of the matrix, used when printing and possibly for access in the future
         std::vector<std::vector<std::string>> labels_;  // label for each 'column' in each dimension; will be used for tables in the future
+        bool ring_ = false;                             // push overwrites the oldest entry of the first dimension when full
+        int ring_start_ = 0;                            // storage position of the oldest entry in a ring buffer
 
 
         int calculate_size() // Calculate the number of elements in the matrix; this can be different from its size in memory
@@ -119,9 +126,15 @@ namespace ikaros
             friend bool operator!= (const iterator& a, const iterator& b){  return !(a == b); }
         };
 
+        struct last_state                               // the copy of the matrix made by save() and how it is made; see set_last_mode()
+        {
+            std::shared_ptr<matrix> matrix_;
+            int mode_ = 0;
+        };
+
         std::shared_ptr<matrix_info> info_;             // The description of the matrix, can be shared by different matrices
         std::shared_ptr<std::vector<float>> data_;      // The raw data for the matrix, shared by submatrices
-        std::shared_ptr<matrix> last_;                  // Copy of the matrix
+        std::shared_ptr<last_state> last_ = std::make_shared<last_state>(); // Copy of the matrix; shared by all views so that a write through any of them detaches it
         std::vector<float *> row_pointers_;             // used for backward compatibility with old float ** matrices - deprecated
 
         // iterator
@@ -157,73 +170,17 @@ namespace ikaros
 */
         void operator=(std::string & data_string) // set from data string after resizing
         {
-            auto & rows = split(data_string, ";");
-            auto & row = split(rows.at(0), ",");
-
-            int x = row.size();
-            int y = rows.size();
-
-            if(rows.size() == 1) // 1D - array
-            {
-                realloc(x);
-                //info_ = std::make_shared<matrix_info>(std::vector<int>{x});
-                //data_ = std::make_shared<std::vector<float>>(info_->calculate_size());
-            
-                for(int i=0; i< row.size(); i++)
-                    (*this)(i) = stof(row.at(i));
-            }
-            else // 2D
-            {
-                realloc(y, x);
-                //info_ = std::make_shared<matrix_info>(std::vector<int>{y, x});
-                //data_ = std::make_shared<std::vector<float>>(info_->calculate_size());
-
-                for(int j=0; j< rows.size(); j++)
-                {
-                    auto r = split(rows.at(j), ",");
-                    for(int i=0; i< r.size(); i++)
-                        (*this)(j,i) = stof(r.at(i));
-                }
-            }
+            parse(data_string);
         }
 
-        matrix(const std::string & data_string)
+        matrix(const std::string & data_string):
+            info_(std::make_shared<matrix_info>()),
+            data_(std::make_shared<std::vector<float>>())
         {
-            try 
-            {
-                auto & rows = split(data_string, ";");
-                auto & row = split(rows.at(0), ",");
-
-                int x = row.size();
-                int y = rows.size();
-
-                if(rows.size() == 1) // 1D - array
-                {
-                    info_ = std::make_shared<matrix_info>(std::vector<int>{x});
-                    data_ = std::make_shared<std::vector<float>>(info_->calculate_size());
-                
-                    for(int i=0; i< row.size(); i++)
-                        (*this)(i) = stof(row.at(i));
-                }
-                else // 2D
-                {
-                    info_ = std::make_shared<matrix_info>(std::vector<int>{y, x});
-                    data_ = std::make_shared<std::vector<float>>(info_->calculate_size());
-
-                    for(int j=0; j< rows.size(); j++)
-                    {
-                        auto r = split(rows.at(j), ",");
-                        for(int i=0; i< row.size(); i++)
-                            (*this)(j, i) = stof(r.at(i));
-                    }
-                }
-            }
-            catch(std::out_of_range e)
-            {
-                throw std::invalid_argument("Invalid matrix string");
-            }
+            parse(data_string);
         }
 
+        void parse(const std::string & data_string); // set size and data from a string with rows separated by ';' and values by ','; throws std::invalid_argument with line and column on errors
 
         matrix(const char * data_string) : matrix(std::string(data_string))
         {
@@ -234,7 +191,7 @@ namespace ikaros
         {
             //std::cout << "op[" << i << "]" << std::endl;
             #ifndef NO_MATRIX_CHECKS
-            if(i<0 || i>= info_->shape_.front())
+            if(i<0 || i>= (info_->ring_ ? info_->max_size_.front() : info_->shape_.front())) // rings are indexed by storage position
                 throw std::out_of_range("Index out of range");
             #endif
             matrix r = *this;
@@ -273,6 +230,7 @@ namespace ikaros
         void
         test_fill() // test function that fillls the elements with consecutive numbers - will be removed in the future
         {
+            detach_last();
             for(int i=0; i<data_->size(); i++)
                 (*data_)[i] = float(i);
         }
@@ -539,6 +497,7 @@ namespace ikaros
         {
             if(empty())
                 return *this;
+            detach_last();
             if(is_scalar())
                 (*data_)[info_->offset_] = f((*data_)[info_->offset_]);
             else
@@ -550,6 +509,7 @@ namespace ikaros
         matrix &
         apply(matrix A, std::function<float(float, float)> f) // e = f(A[], x)
         {
+            detach_last();
             if(empty())
                 return *this;
             else if(is_scalar())
@@ -566,6 +526,7 @@ namespace ikaros
         matrix &
         apply(matrix A, matrix B, std::function<float(float, float)> f) // e[] = f(A[], B[])
         {
+            detach_last();
             if(empty())
                 return *this;
             else if(is_scalar())
@@ -597,26 +558,61 @@ namespace ikaros
             return apply([=](float x)->float {return v;});
         }
 
+        int
+        element_count() const // number of elements in the matrix or submatrix
+        {
+            return rank() == 0 ? info_->size_ : info_->calculate_size();
+        }
+
+        static void
+        copy_strided(float * target, const matrix_info & t, const float * source, const matrix_info & s, int d=0) // copy row by row when either side is a submatrix with gaps
+        {
+            int n = t.shape_[d];
+            if(d == t.shape_.size()-1)
+            {
+                std::memmove(target, source, n*sizeof(float));
+                return;
+            }
+            int target_stride = 1;
+            int source_stride = 1;
+            for(int i=d+1; i<t.stride_.size(); i++)
+            {
+                target_stride *= t.stride_[i];
+                source_stride *= s.stride_[i];
+            }
+            for(int i=0; i<n; i++)
+                copy_strided(target+i*target_stride, t, source+i*source_stride, s, d+1);
+        }
+
         matrix & 
-        copy(matrix m)  // asign matrix or submatrix - copy data
+        copy(const matrix & m)  // asign matrix or submatrix - copy data
         {
-            if(rank()==0)   // Allow copy to empty matrix after reallocation - //TODO: Check if this is always appropriate
+            TRACE_SCOPE("matrix::copy");
+            detach_last();
+            if(empty())   // Allow copy to empty matrix after reallocation - //TODO: Check if this is always appropriate
                 realloc(m.shape());
 
             #ifndef NO_MATRIX_CHECKS
                 if(info_->shape_ != m.info_->shape_)
                     throw std::out_of_range("Assignment requires matrices of the same size");
             #endif 
-            //std::copy_n(m.data_->begin()+offset_, m.size_, data_->begin()+offset_);
-            for(int i=0; i<m.info_->size_; i++)
-                data_->at(info_->offset_+i) = m.data_->at(m.info_->offset_+i);
-            // TODO: must be updated for proper submatices
+            int n = m.element_count();
+            if(n == 0)
+                return *this;
+
+            const float * source = m.data_->data() + m.info_->offset_;
+            float * target = data_->data() + info_->offset_;
+            if(contiguous() && m.contiguous())
+                std::memmove(target, source, n*sizeof(float)); // memmove since views of the same data may overlap
+            else
+                copy_strided(target, *info_, source, *m.info_);
             return *this;
         }
     
         matrix &
         copy(matrix & m, range & target, range & source)
         {
+            detach_last();
             source.reset();
             target.reset();
 
@@ -639,6 +635,7 @@ namespace ikaros
 
         operator float & ()
         {
+            detach_last();
             #ifndef NO_MATRIX_CHECKS
             if(info_->size_ != 1)
                 throw empty_matrix_error(get_name()+" Not a matrix element.");
@@ -650,11 +647,13 @@ namespace ikaros
 
         operator float * ()  // Get pointer to data in a row
         { 
+            detach_last();
             return &(*data_).data()[info_->offset_];
         }
 
         operator float ** ()  // Get pointer to data in a row
         { 
+            detach_last();
             if(rank() != 2)
                 throw std::out_of_range(get_name()+"Matrix must be two-dimensional.");
 
@@ -668,9 +667,16 @@ namespace ikaros
         float * 
         data() // Get pointer to the underlying data. Works for all sizes and for submatrices
         {
+                detach_last();
                 return &data_->data()[info_->offset_];
         }     
 
+        const float *
+        data() const // for reading only; does not copy data shared with last
+        {
+                return &data_->data()[info_->offset_];
+        }
+
         matrix &
         reset() // reset the matrix 
         {
@@ -719,6 +725,7 @@ namespace ikaros
         template <typename... Args>
         float& operator()(Args... indices)
         {
+            detach_last();
             #ifndef NO_MATRIX_CHECKS
             if (sizeof...(indices) != info_->shape_.size())
             throw std::invalid_argument(get_name()+"Number of indices must match matrix rank.");
@@ -790,6 +797,7 @@ namespace ikaros
         matrix & 
         realloc(Args... shape)
         {
+            detach_last();
             info_-> offset_ = 0; 
             info_-> shape_ = std::vector<int>({shape...}); 
             info_->stride_ = std::vector<int>({shape...});
@@ -836,10 +844,105 @@ namespace ikaros
             info_->labels_.resize(info_->shape_.size());
             return *this;
         }
+        // Slices
+
+        int
+        row_stride() const // distance in memory between consecutive entries of the first dimension
+        {
+            int s = 1;
+            for(int d=1; d<info_->stride_.size(); d++)
+                s *= info_->stride_[d];
+            return s;
+        }
+
+        matrix
+        slice(int a, int b) // submatrix with entries a to b-1 of the first dimension; shares data with this matrix
+        {
+            #ifndef NO_MATRIX_CHECKS
+            if(rank() == 0)
+                throw std::out_of_range(get_name()+"Cannot slice a scalar.");
+            if(a<0 || b<a || b>info_->max_size_.front())
+                throw std::out_of_range(get_name()+"Slice out of range.");
+            #endif
+            matrix r = *this;
+            r.info_ = std::make_shared<matrix_info>(*info_);
+            r.info_->offset_ += a*row_stride();
+            r.info_->shape_.front() = b-a;
+            r.info_->max_size_.front() = b-a; // a slice cannot push into the entries that follow it
+            r.info_->size_ = r.info_->calculate_size();
+            r.info_->ring_ = false;
+            r.info_->ring_start_ = 0;
+            auto & labels = r.info_->labels_.front();
+            if(labels.size() > a)
+                labels = std::vector<std::string>(labels.begin()+a, labels.begin()+std::min<int>(b, labels.size()));
+            else
+                labels.clear();
+            return r;
+        }
+
         // Push & pop
 
-        matrix & 
-        push(const matrix & m)
+        matrix &
+        reserve(int capacity) // allocate room for capacity entries in the first dimension; invalidates pointers to the data
+        {
+            #ifndef NO_MATRIX_CHECKS
+            if(rank() == 0)
+                throw std::out_of_range(get_name()+"Cannot reserve space in a scalar.");
+            if(info_->ring_)
+                throw std::out_of_range(get_name()+"Cannot grow a ring buffer.");
+            #endif
+            if(capacity <= info_->max_size_.front())
+                return *this;
+            if(!owns_allocation())
+                throw std::out_of_range(get_name()+"Cannot grow a submatrix.");
+            info_->max_size_.front() = capacity;
+            info_->stride_.front() = capacity;
+            detach_last();
+            data_->resize(capacity*row_stride());
+            row_pointers_.clear();
+            return *this;
+        }
+
+        matrix &
+        ring(int capacity) // turn the matrix into a ring buffer with capacity entries; push overwrites the oldest entry when full
+        {
+            #ifndef NO_MATRIX_CHECKS
+            if(rank() == 0)
+                throw std::out_of_range(get_name()+"A ring buffer needs at least one dimension.");
+            if(capacity < 1)
+                throw std::out_of_range(get_name()+"Ring buffer capacity must be positive.");
+            #endif
+            info_->ring_ = false;
+            reserve(capacity);
+            info_->max_size_.front() = capacity; // a ring never grows so the capacity is exact
+            info_->shape_.front() = 0;
+            info_->size_ = 0;
+            info_->ring_ = true;
+            info_->ring_start_ = 0;
+            return *this;
+        }
+
+        bool is_ring() const { return info_->ring_; }
+
+        int
+        ring_index(int i) const // storage position of entry i where 0 is the oldest entry; identity if not a ring buffer
+        {
+            if(!info_->ring_)
+                return i;
+            return (info_->ring_start_+i) % info_->max_size_.front();
+        }
+
+        std::pair<matrix, matrix>
+        spans() // the entries from oldest to newest as two contiguous slices; the second is empty unless the ring has wrapped
+        {
+            int n = info_->shape_.front();
+            int start = info_->ring_ ? info_->ring_start_ : 0;
+            int first_end = std::min(start+n, info_->max_size_.front());
+            return {slice(start, first_end), slice(0, start+n-first_end)};
+        }
+
+        matrix &
+        push(const matrix & m) // append m as a new last entry; grows the allocation geometrically or overwrites the oldest entry of a ring
         {
             #ifndef NO_MATRIX_CHECKS
             if(rank() != m.rank()+1)
@@ -847,14 +950,22 @@ namespace ikaros
             for(int i=0; i<m.info_->shape_.size(); i++)
                 if(info_->shape_[i+1] != m.info_->shape_[i])
                     throw std::out_of_range(get_name()+"Pushed matrix has wrong shape.");
+            #endif
+            (*this)[next_push_index()].copy(m);
+            return *this;
+        }
 
-            if(info_->shape_.front() >= info_->max_size_.front())
-                throw std::out_of_range(get_name()+"No room for additional element");
+        matrix &
+        push(float v) // append a value to a one-dimensional matrix
+        {
+            #ifndef NO_MATRIX_CHECKS
+            if(rank() != 1)
+                throw std::out_of_range(get_name()+"Values can only be pushed to one-dimensional matrices.");
             #endif
-            if(info_->shape_.front() < info_->max_size_.front())
-                return (*this)[info_->shape_.front()++].copy(m);
-            else
-                return *this;
+            detach_last();
+            int i = next_push_index();
+            (*data_)[info_->offset_+i] = v;
+            return *this;
         }
 
         matrix &
@@ -864,11 +975,34 @@ namespace ikaros
             if(m.info_->shape_.front() == 0)
                 throw std::out_of_range(get_name()+"Nothing to pop.");
             #endif
-            copy(m[m.info_->shape_.front()-1]);
+            copy(m[m.ring_index(m.info_->shape_.front()-1)]);
             m.info_->shape_.front()--;
+            m.info_->size_ = m.info_->calculate_size();
             return *this;
         }
 
+        int
+        next_push_index() // make room for one more entry and return its position in storage
+        {
+            int & n = info_->shape_.front();
+            int capacity = info_->max_size_.front();
+            if(info_->ring_ && n == capacity)
+            {
+                int i = info_->ring_start_;
+                info_->ring_start_ = (i+1) % capacity;
+                return i;
+            }
+            if(n >= capacity)
+            {
+                if(!owns_allocation())
+                    throw std::out_of_range(get_name()+"No room for additional element");
+                reserve(std::max(4, 2*capacity));
+            }
+            int i = ring_index(n++);
+            info_->size_ = info_->calculate_size();
+            return i;
+        }
+
 
         matrix operator[](std::string n)
         {
@@ -896,6 +1030,7 @@ namespace ikaros
             if(info_->size_ != 1)
                 throw std::out_of_range(get_name()+"Not a matrix element.");
             #endif
+            detach_last();
             data_->at(info_->offset_) = v;
             return  v; 
         }
@@ -917,6 +1052,177 @@ namespace ikaros
         matrix & multiply(matrix A, matrix B) { check_same_size(A); check_same_size(B); return apply(A, B, [](float x, float y)->float {return x*y;}); }
         matrix & divide(matrix A, matrix B)   { check_same_size(A); check_same_size(B); return apply(A, B, [](float x, float y)->float {return x/y;}); }
 
+        // Parallel functions - split the first dimension into tasks for the shared thread pool
+
+        static int &
+        parallel_grain() // default minimum number of elements in each parallel task; smaller matrices are processed sequentially
+        {
+            static int grain = 32768;
+            return grain;
+        }
+
+        bool
+        contiguous() const // are all elements stored consecutively in memory?
+        {
+            for(int d=1; d<info_->shape_.size(); d++)
+                if(info_->shape_[d] != info_->stride_[d])
+                    return false;
+            return true;
+        }
+
+        int
+        parallel_rows(int grain=0) const // number of entries in the first dimension for each parallel task
+        {
+            if(grain <= 0)
+                grain = parallel_grain();
+            int row_size = 1;
+            for(int d=1; d<info_->shape_.size(); d++)
+                row_size *= info_->shape_[d];
+            return std::max(1, grain/std::max(1, row_size));
+        }
+
+        matrix &
+        par_apply(std::function< float(float) > f, int grain=0) // Parallel version of apply; f must be thread safe
+        {
+            if(rank() == 0)
+                return apply(f);
+
+            detach_last();
+            thread_pool::instance().parallel_for(0, info_->shape_.front(), parallel_rows(grain), [&](int a, int b)
+            {
+                if(rank() == 1)
+                {
+                    float * p = &(*data_)[info_->offset_];
+                    for(int i=a; i<b; i++)
+                        p[i] = f(p[i]);
+                    return;
+                }
+                for(int i=a; i<b; i++)
+                {
+                    matrix X = (*this)[i];
+                    if(!X.contiguous())
+                    {
+                        X.apply(f);
+                        continue;
+                    }
+                    float * p = X.data();
+                    int n = X.info_->calculate_size();
+                    for(int j=0; j<n; j++)
+                        p[j] = f(p[j]);
+                }
+            });
+            return *this;
+        }
+
+        matrix &
+        par_apply(matrix A, std::function<float(float, float)> f, int grain=0) // Parallel version of apply; e = f(e, A[])
+        {
+            check_same_size(A);
+            if(rank() == 0)
+                return apply(A, f);
+
+            detach_last();
+            thread_pool::instance().parallel_for(0, info_->shape_.front(), parallel_rows(grain), [&](int a, int b)
+            {
+                if(rank() == 1)
+                {
+                    float * p = &(*data_)[info_->offset_];
+                    float * q = &(*A.data_)[A.info_->offset_];
+                    for(int i=a; i<b; i++)
+                        p[i] = f(p[i], q[i]);
+                    return;
+                }
+                for(int i=a; i<b; i++)
+                {
+                    matrix X = (*this)[i];
+                    matrix Y = A[i];
+                    if(!X.contiguous() || !Y.contiguous())
+                    {
+                        X.apply(Y, f);
+                        continue;
+                    }
+                    float * p = X.data();
+                    float * q = Y.data();
+                    int n = X.info_->calculate_size();
+                    for(int j=0; j<n; j++)
+                        p[j] = f(p[j], q[j]);
+                }
+            });
+            return *this;
+        }
+
+        float
+        par_reduce(float init, std::function<float(float, float)> op, int grain=0) // Parallel reduction; init must be the identity of op, e.g. 0 for + or 1 for *
+        {
+            if(empty())
+                return init;
+            if(rank() == 0)
+                return op(init, (*data_)[info_->offset_]);
+
+            int n = info_->shape_.front();
+            int rows = parallel_rows(grain);
+            int tasks = (n+rows-1)/rows;
+            std::vector<float> partial(tasks, init); // one result per task keeps the result independent of the number of threads
+
+            thread_pool::instance().parallel_for(0, tasks, 1, [&](int a, int b)
+            {
+                for(int t=a; t<b; t++)
+                {
+                    float s = init;
+                    int last = std::min(n, (t+1)*rows);
+                    for(int i=t*rows; i<last; i++)
+                    {
+                        if(rank() == 1)
+                        {
+                            s = op(s, (*data_)[info_->offset_+i]);
+                            continue;
+                        }
+                        matrix X = (*this)[i];
+                        if(!X.contiguous())
+                        {
+                            X.reduce([&](float x) { s = op(s, x); });
+                            continue;
+                        }
+                        float * p = X.data();
+                        int m = X.info_->calculate_size();
+                        for(int j=0; j<m; j++)
+                            s = op(s, p[j]);
+                    }
+                    partial[t] = s;
+                }
+            });
+
+            float s = init;
+            for(float p : partial)
+                s = op(s, p);
+            return s;
+        }
+
+        matrix &
+        par_copy(const matrix & m, int grain=0) // Parallel version of copy
+        {
+            TRACE_SCOPE("matrix::par_copy");
+            if(rank()==0)
+                realloc(m.shape());
+
+            #ifndef NO_MATRIX_CHECKS
+                if(info_->shape_ != m.info_->shape_)
+                    throw std::out_of_range("Assignment requires matrices of the same size");
+            #endif
+            matrix source = m; // shares data with m
+            detach_last();
+
+            thread_pool::instance().parallel_for(0, info_->shape_.front(), parallel_rows(grain), [&](int a, int b)
+            {
+                if(rank() == 1)
+                    std::copy_n(&(*source.data_)[source.info_->offset_+a], b-a, &(*data_)[info_->offset_+a]);
+                else
+                    for(int i=a; i<b; i++)
+                        (*this)[i].copy(source[i]);
+            });
+            return *this;
+        }
+
         int
         compute_index(std::vector<int> & v)
         {
@@ -947,6 +1253,7 @@ namespace ikaros
         matrix &
         matmul(matrix & A, matrix & B) // Compute matrix multiplication A*B and put result in current matrix // FIXME: realloc() if this.rank() = 0
         {
+            TRACE_SCOPE("matrix::matmul");
             if(empty())
                 realloc(A.rows(), B.cols());
 
@@ -992,6 +1299,7 @@ namespace ikaros
         matrix &
         corr(matrix & I, matrix & K) // correlation of I and K
         {
+            TRACE_SCOPE("matrix::corr");
                 #ifndef NO_MATRIX_CHECKS
                 if(rank() != 2 || I.rank() !=2 || K.rank() != 2)
                     throw std::invalid_argument("Convolution requires two-dimensional matrices.");
@@ -1021,6 +1329,7 @@ namespace ikaros
         matrix &
         conv(matrix & I, matrix & K) // Convolution of I and K
         {
+            TRACE_SCOPE("matrix::conv");
                 #ifndef NO_MATRIX_CHECKS
                 if(rank() != 2 || I.rank() !=2 || K.rank() != 2)
                     throw std::invalid_argument("Convolution requires two-dimensional matrices.");
@@ -1068,20 +1377,66 @@ namespace ikaros
 
         // Last Functions
 
-        void save()
+        enum last_mode
+        {
+            copy_last,      // save() copies the data to last
+            swap_last,      // save() swaps the storage of the matrix and last in O(1); the matrix must be completely overwritten before it is read again
+            share_last      // save() lets last share the storage in O(1); it is copied on the first write to the matrix (copy on write), or by detach_last() before last is written
+        };
+
+        matrix &
+        set_last_mode(last_mode mode)
+        {
+            detach_last();
+            last_->mode_ = mode;
+            return *this;
+        }
+
+        bool
+        owns_allocation() const // does the matrix use all of its storage, including the room reserved for more entries? only then can it grow
+        {
+            return rank() > 0 && info_->offset_ == 0 && data_->size() == size_t(info_->max_size_.front())*row_stride();
+        }
+
+        bool
+        owns_storage() const // is this a complete matrix and not a view into a larger one?
+        {
+            return info_->offset_ == 0 && contiguous() && data_->size() == info_->calculate_size();
+        }
+
+        void save() // last and its mode belong to the matrix and all its views, so save() and last() should be called on the whole matrix
+        {
+            matrix * last = last_->matrix_.get();
+            if(last == nullptr)
+                return;
+            bool same_layout = last->info_->shape_ == info_->shape_ && owns_storage() && last->owns_storage();
+            if(last_->mode_ == swap_last && same_layout)
+                std::swap(*data_, *last->data_); // swaps the buffer pointers; views of both matrices stay valid
+            else if(last_->mode_ == share_last && same_layout)
+                last->data_ = data_;
+            else
+            {
+                detach_last();
+                last->copy(*this);
+            }
+        }
+
+        void
+        detach_last() // give last its own copy of the data if it is shared with the matrix; called before every write
         {
-            if(last_!=nullptr)
-                last_->copy(*this);
+            matrix * last = last_->matrix_.get();
+            if(last != nullptr && last->data_ == data_)
+                last->data_ = std::make_shared<std::vector<float>>(*data_);
         }
 
         matrix & last()
         {
-            if(last_==nullptr)
+            if(last_->matrix_ == nullptr)
             {
-                last_ = std::make_shared<matrix>();
+                last_->matrix_ = std::make_shared<matrix>();
                 save();
             }
-            return *last_;
+            return *last_->matrix_;
         }
 
         // Math Functions
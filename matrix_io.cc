@@ -0,0 +1,257 @@
+// matrix_io.cc   (c) Christian Balkenius 2024
+
+#include "matrix_io.h"
+
+#include <climits>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ikaros
+{
+    static const char matrix_file_magic[4] = {'I', 'K', 'M', 'X'};
+
+    static void
+    check_byte_order()
+    {
+        uint32_t one = 1;
+        if(*reinterpret_cast<char *>(&one) != 1)
+            throw exception("Binary matrix files are only supported on little endian machines.");
+    }
+
+
+    template <typename T>
+    static void
+    append(std::string & s, T value)
+    {
+        s.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+
+    static void
+    append(std::string & s, const std::string & value)
+    {
+        append<uint32_t>(s, value.size());
+        s += value;
+    }
+
+
+    struct header_reader // bounds checked reading from the start of a file
+    {
+        const char *    p;
+        size_t          size;
+        size_t          pos = 0;
+
+        header_reader(const char * p, size_t size) : p(p), size(size) {}
+
+        template <typename T>
+        T
+        get()
+        {
+            if(pos+sizeof(T) > size)
+                throw exception("Truncated matrix file header.");
+            T value;
+            std::memcpy(&value, p+pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        std::string
+        get_string()
+        {
+            uint32_t n = get<uint32_t>();
+            if(pos+n > size)
+                throw exception("Truncated matrix file header.");
+            std::string s(p+pos, n);
+            pos += n;
+            return s;
+        }
+    };
+
+
+    void
+    write_binary(std::ostream & os, matrix & m)
+    {
+        TRACE_SCOPE("matrix_io::write_binary");
+        check_byte_order();
+
+        std::vector<int> shape = m.shape();
+        uint64_t count = m.element_count();
+
+        std::string header(matrix_file_magic, 4);
+        append<uint32_t>(header, matrix_file_version);
+        append<uint32_t>(header, dtype_float32);
+        append<uint32_t>(header, shape.size());
+        size_t offset_position = header.size();
+        append<uint64_t>(header, 0); // payload offset is filled in below
+        append<uint64_t>(header, count);
+        for(int s : shape)
+            append<int32_t>(header, s);
+        append(header, m.info_->name_);
+        for(int d=0; d<shape.size(); d++)
+        {
+            const std::vector<std::string> & labels = d < m.info_->labels_.size() ? m.info_->labels_[d] : std::vector<std::string>();
+            append<uint32_t>(header, labels.size());
+            for(auto & l : labels)
+                append(header, l);
+        }
+        header.resize((header.size()+matrix_file_alignment-1)/matrix_file_alignment*matrix_file_alignment, '\0');
+        uint64_t payload_offset = header.size();
+        std::memcpy(&header[offset_position], &payload_offset, sizeof(payload_offset));
+
+        os.write(header.data(), header.size());
+        if(count == 0)
+            return;
+
+        if(m.contiguous())
+            os.write(reinterpret_cast<const char *>(m.data_->data()+m.info_->offset_), count*sizeof(float));
+        else
+        {
+            matrix packed;
+            packed.copy(m);
+            os.write(reinterpret_cast<const char *>(packed.data_->data()), count*sizeof(float));
+        }
+        if(!os)
+            throw exception("Could not write matrix.");
+    }
+
+
+    void
+    save_binary(const std::string & filename, matrix & m)
+    {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if(!file)
+            throw exception("Could not open \""+filename+"\" for writing.");
+        write_binary(file, m);
+    }
+
+
+    matrix
+    load_binary(const std::string & filename)
+    {
+        return mapped_matrix(filename).copy();
+    }
+
+
+    matrix_file_header
+    parse_matrix_header(const char * p, size_t size)
+    {
+        check_byte_order();
+
+        header_reader r(p, size);
+        if(size < 4 || std::memcmp(p, matrix_file_magic, 4) != 0)
+            throw exception("Not a binary matrix file.");
+        r.pos = 4;
+
+        matrix_file_header h;
+        uint32_t version = r.get<uint32_t>();
+        if(version != matrix_file_version)
+            throw exception("Unsupported matrix file version "+std::to_string(version)+".");
+        h.dtype = r.get<uint32_t>();
+        if(h.dtype != dtype_float32)
+            throw exception("Unsupported matrix element type "+std::to_string(h.dtype)+".");
+        uint32_t rank = r.get<uint32_t>();
+        h.payload_offset = r.get<uint64_t>();
+        h.count = r.get<uint64_t>();
+
+        uint64_t n = 1;
+        for(int d=0; d<rank; d++)
+        {
+            int s = r.get<int32_t>();
+            if(s < 0)
+                throw exception("Negative size in matrix file.");
+            h.shape.push_back(s);
+            n *= s; // cannot wrap, since both factors are at most INT_MAX
+            if(n > INT_MAX)
+                throw exception("Matrix in file has too many elements.");
+        }
+        if(n != h.count && !(rank == 0 && h.count == 0)) // a scalar has one element; an empty matrix without shape has none
+            throw exception("Matrix file shape does not match its element count.");
+
+        h.name = r.get_string();
+        h.labels.resize(rank);
+        for(auto & labels : h.labels)
+        {
+            uint32_t k = r.get<uint32_t>();
+            for(int i=0; i<k; i++)
+                labels.push_back(r.get_string());
+        }
+
+        if(h.payload_offset < r.pos || h.payload_offset % alignof(float) != 0)
+            throw exception("Bad payload offset in matrix file.");
+        return h;
+    }
+
+
+    mapped_matrix::mapped_matrix(const std::string & filename)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+            throw exception("Could not open \""+filename+"\".");
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            throw exception("Could not read \""+filename+"\".");
+        }
+        map_size_ = st.st_size;
+        map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // the mapping stays valid
+        if(map_ == MAP_FAILED)
+        {
+            map_ = nullptr;
+            throw exception("Could not map \""+filename+"\".");
+        }
+
+        try
+        {
+            header_ = parse_matrix_header(static_cast<const char *>(map_), map_size_);
+            if(header_.payload_offset > map_size_ || header_.count > (map_size_-header_.payload_offset)/sizeof(float))
+                throw exception("Truncated matrix file \""+filename+"\".");
+        }
+        catch(...)
+        {
+            munmap(map_, map_size_);
+            throw;
+        }
+        data_ = reinterpret_cast<const float *>(static_cast<const char *>(map_)+header_.payload_offset);
+    }
+
+
+    mapped_matrix::~mapped_matrix()
+    {
+        if(map_)
+            munmap(map_, map_size_);
+    }
+
+
+    const float *
+    mapped_matrix::row(int i) const
+    {
+        if(rank() == 0 || i < 0 || i >= header_.shape.front())
+            throw std::out_of_range("Index out of range");
+        return data_ + size_t(i)*(header_.count/header_.shape.front());
+    }
+
+
+    matrix
+    mapped_matrix::copy() const
+    {
+        matrix m(header_.shape);
+        if(rank() == 0 && header_.count == 1) // scalar
+        {
+            m.data_->resize(1);
+            m.info_->size_ = 1;
+        }
+        if(header_.count > 0)
+            std::memcpy(m.data_->data(), data_, header_.count*sizeof(float));
+        m.info_->name_ = header_.name;
+        m.info_->labels_ = header_.labels;
+        return m;
+    }
+};
@@ -0,0 +1,77 @@
+// matrix_io.h - binary matrix files (c) Christian Balkenius 2024
+//
+// File layout, all numbers little endian:
+//
+//  magic "IKMX", uint32 version, uint32 dtype, uint32 rank, uint64 payload offset, uint64 element count
+//  rank x int32 shape
+//  uint32 length + name
+//  for each dimension: uint32 number of labels, then uint32 length + label for each
+//  zero padding to a multiple of 64 bytes
+//  payload: the elements in row major order
+//
+
+#ifndef MATRIX_IO
+#define MATRIX_IO
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+
+namespace ikaros
+{
+    const uint32_t matrix_file_version = 1;
+    const uint32_t matrix_file_alignment = 64;
+
+    enum matrix_dtype : uint32_t
+    {
+        dtype_float32 = 0
+    };
+
+    struct matrix_file_header
+    {
+        uint32_t                                dtype = dtype_float32;
+        uint64_t                                payload_offset = 0;
+        uint64_t                                count = 0;
+        std::vector<int>                        shape;
+        std::string                             name;
+        std::vector<std::vector<std::string>>   labels;
+    };
+
+    void write_binary(std::ostream & os, matrix & m);                  // write matrix in binary format
+    void save_binary(const std::string & filename, matrix & m);        // write matrix to a binary file
+    matrix load_binary(const std::string & filename);                  // read a binary file into a new matrix with a single bulk copy
+
+    matrix_file_header parse_matrix_header(const char * p, size_t size);    // throws if the buffer does not start with a valid header
+
+    class mapped_matrix // read-only view of a binary matrix file mapped into memory; the payload is never copied
+    {
+    public:
+        mapped_matrix(const std::string & filename);
+        ~mapped_matrix();
+
+        mapped_matrix(const mapped_matrix &) = delete;
+        mapped_matrix & operator=(const mapped_matrix &) = delete;
+
+        const float * data() const { return data_; }
+        const std::vector<int> & shape() const { return header_.shape; }
+        const std::vector<std::string> & labels(int dimension=0) const { return header_.labels.at(dimension); }
+        const std::string & name() const { return header_.name; }
+        int rank() const { return header_.shape.size(); }
+        int size() const { return header_.count; }    // files with more than INT_MAX elements are rejected
+
+        const float * row(int i) const; // pointer to entry i of the first dimension
+
+        matrix copy() const; // copy to an ordinary matrix
+
+    private:
+        void *              map_ = nullptr;
+        size_t              map_size_ = 0;
+        matrix_file_header  header_;
+        const float *       data_ = nullptr;
+    };
+};
+
+#endif
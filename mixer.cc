@@ -0,0 +1,371 @@
+// mixer.cc   (c) Christian Balkenius 2024
+
+#include "mixer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "alloc.h"
+#include "trace.h"
+
+namespace ikaros
+{
+    static const int spin_count = 2000; // checks of the generation before a worker goes to sleep
+
+
+    template <int C>
+    static void
+    mix_frames(float * __restrict out, const float * __restrict in, const float * gains, int n) // interleaved; the number of channels is a constant so that the loops vectorize
+    {
+        float g[C];
+        for(int c=0; c<C; c++)
+            g[c] = gains[c];
+        for(int i=0; i<n; i++)
+            for(int c=0; c<C; c++)
+                out[C*i+c] += g[c]*in[i];
+    }
+
+
+    static void
+    mix_samples(float * __restrict out, const float * __restrict in, float g, int n) // planar
+    {
+        for(int i=0; i<n; i++)
+            out[i] += g*in[i];
+    }
+
+
+    static void
+    mix_frames(float * out, const float * in, const float * g, int n, int channels)
+    {
+        switch(channels)
+        {
+            case 1: mix_frames<1>(out, in, g, n); break;
+            case 2: mix_frames<2>(out, in, g, n); break;
+            case 3: mix_frames<3>(out, in, g, n); break;
+            case 4: mix_frames<4>(out, in, g, n); break;
+            case 5: mix_frames<5>(out, in, g, n); break;
+            case 6: mix_frames<6>(out, in, g, n); break;
+            case 7: mix_frames<7>(out, in, g, n); break;
+            default: mix_frames<8>(out, in, g, n); break;
+        }
+    }
+
+
+    mixer::mixer(int threads)
+    {
+        if(threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        queues_ = std::make_unique<queue[]>(threads);
+        for(int i=1; i<threads; i++)
+            workers_.emplace_back(&mixer::worker, this, i);
+    }
+
+
+    mixer::~mixer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for(auto & t : workers_)
+            t.join();
+    }
+
+
+    std::unique_ptr<mixer::voice>
+    mixer::make_voice(patch && sound, float gain, float duration, uint64_t seed, long tag)
+    {
+        auto v = std::make_unique<voice>(voice{std::move(sound), gain, tag});
+        v->buffer.assign(block_size, 0);
+        v->sound.start(duration, seed);
+        v->playing = !v->sound.finished();
+        return v;
+    }
+
+
+    void
+    mixer::reserve(int voices)
+    {
+        voices_.reserve(voices);
+        for(int q=0; q<threads(); q++)
+            queues_[q].tasks.reserve(voices);
+    }
+
+
+    int
+    mixer::add(std::unique_ptr<voice> v)
+    {
+        if(voices_.size() == voices_.capacity())
+            reserve(std::max(16, 2*int(voices_.size())));
+        pan(*v);
+        voices_.push_back(std::move(v));
+        return int(voices_.size())-1;
+    }
+
+
+    void
+    mixer::remove_finished()
+    {
+        voices_.erase(std::remove_if(voices_.begin(), voices_.end(), [](auto & v) { return !v->playing; }), voices_.end());
+    }
+
+
+    int
+    mixer::find(long tag) const
+    {
+        for(int i=0; i<voices_.size(); i++)
+            if(voices_[i]->tag == tag)
+                return i;
+        return -1;
+    }
+
+
+    void
+    mixer::set_gain(int index, float gain)
+    {
+        voices_.at(index)->gain = gain;
+    }
+
+
+    void
+    mixer::stop(int index)
+    {
+        voices_.at(index)->playing = false;
+    }
+
+
+    void
+    mixer::set_position(int index, float azimuth, float distance)
+    {
+        voice & v = *voices_.at(index);
+        v.azimuth = azimuth;
+        v.distance = distance;
+        pan(v);
+    }
+
+
+    void
+    mixer::set_speakers(const std::vector<float> & azimuths)
+    {
+        if(azimuths.empty() || azimuths.size() > max_channels)
+            throw exception("A mixer needs between 1 and "+std::to_string(max_channels)+" speakers.");
+        speakers_ = azimuths;
+        for(auto & v : voices_)
+            pan(*v);
+    }
+
+
+    void
+    mixer::pan(voice & v) // pairwise constant power panning; does not allocate
+    {
+        int n = channels();
+        std::fill(v.pan, v.pan+max_channels, 0.0f);
+        float attenuation = 1 / std::max(1.0f, v.distance);
+        if(n == 1)
+        {
+            v.pan[0] = attenuation;
+            return;
+        }
+
+        auto wrap = [](float a) { return a - 360 * std::floor(a / 360); }; // into [0, 360)
+        int left = 0;
+        float t = 0;    // position from the left speaker to the right one
+        if(n == 2)
+        {
+            float a = wrap(v.azimuth+180)-180; // sounds behind are mirrored to the front
+            if(a > 90)
+                a = 180-a;
+            else if(a < -90)
+                a = -180-a;
+            float width = speakers_[1]-speakers_[0];
+            t = width != 0 ? std::clamp((a-speakers_[0]) / width, 0.0f, 1.0f) : 0.5f;
+        }
+        else
+            for(int i=0; i<n; i++)
+            {
+                float arc = wrap(speakers_[(i+1) % n]-speakers_[i]);
+                float a = wrap(v.azimuth-speakers_[i]);
+                if(a <= arc)
+                {
+                    left = i;
+                    t = arc > 0 ? a / arc : 0;
+                    break;
+                }
+            }
+        v.pan[left] = attenuation * std::cos(t * float(M_PI) / 2);
+        v.pan[(left+1) % n] += attenuation * std::sin(t * float(M_PI) / 2);
+    }
+
+
+    int
+    mixer::playing() const
+    {
+        int n = 0;
+        for(auto & v : voices_)
+            n += v->playing;
+        return n;
+    }
+
+
+    void
+    mixer::render_voice(voice & v)
+    {
+        TRACE_SCOPE("mixer::voice");
+        int64_t begin = monitor_ ? monitor_->now() : 0;
+        int written = v.sound.process(v.buffer.data(), block_);
+        if(monitor_)
+            monitor_->voice(v.tag, begin, monitor_->now());
+        std::fill(v.buffer.data()+written, v.buffer.data()+block_, 0.0f);
+        v.playing = !v.sound.finished();
+    }
+
+
+    void
+    mixer::run(int index)
+    {
+        int n = threads();
+        for(int k=0; k<n; k++)
+        {
+            queue & q = queues_[(index+k) % n];
+            for(int i = q.next.fetch_add(1); i < q.count; i = q.next.fetch_add(1))
+                render_voice(*voices_[q.tasks[i]]);
+        }
+    }
+
+
+    void
+    mixer::worker(int index)
+    {
+        trace_thread();
+        long seen = 0;
+        for(;;)
+        {
+            for(int s=0; s<spin_count && generation_.load(std::memory_order_acquire) == seen; s++)
+                std::this_thread::yield();
+
+            if(generation_.load(std::memory_order_acquire) == seen)
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [&]{ return stop_ || generation_ != seen; });
+            }
+            if(stop_)
+                return;
+            seen = generation_.load(std::memory_order_acquire);
+
+            {
+                no_alloc_scope guard("mixer worker");
+                run(index);
+            }
+            pending_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+
+    void
+    mixer::process(float * out, int n)
+    {
+        mix(out, nullptr, n);
+    }
+
+
+    void
+    mixer::process(float * const * out, int n)
+    {
+        mix(nullptr, out, n);
+    }
+
+
+    void
+    mixer::mix(float * interleaved, float * const * planar, int n)
+    {
+        no_alloc_scope guard("mixer::process");
+        int nq = threads();
+        int nc = channels();
+        for(int first=0; first<n; first+=block_size)
+        {
+            TRACE_SCOPE("mixer::block");
+            block_ = std::min(block_size, n-first);
+            if(planar)
+                for(int c=0; c<nc; c++)
+                    std::fill(planar[c]+first, planar[c]+first+block_, 0.0f);
+            else
+                std::fill(interleaved+nc*first, interleaved+nc*(first+block_), 0.0f);
+
+            for(int q=0; q<nq; q++)
+                queues_[q].tasks.clear();
+            int tasks = 0;
+            for(int i=0; i<voices_.size(); i++)
+            {
+                voices_[i]->mixed = voices_[i]->playing;
+                if(voices_[i]->mixed)
+                    queues_[tasks++ % nq].tasks.push_back(i);
+            }
+            if(tasks == 0)
+                continue;
+            for(int q=0; q<nq; q++)
+            {
+                queues_[q].count = int(queues_[q].tasks.size());
+                queues_[q].next.store(0, std::memory_order_relaxed);
+            }
+
+            if(tasks > 1 && !workers_.empty())
+            {
+                pending_.store(int(workers_.size()), std::memory_order_relaxed);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    generation_.fetch_add(1, std::memory_order_release);
+                }
+                start_.notify_all();
+                run(0);
+                while(pending_.load(std::memory_order_acquire) > 0)
+                    std::this_thread::yield();
+            }
+            else
+                run(0);
+
+            for(auto & v : voices_)
+                if(v->mixed)
+                {
+                    const float * b = v->buffer.data();
+                    float g[max_channels];
+                    for(int c=0; c<nc; c++)
+                        g[c] = v->gain * v->pan[c];
+                    if(!planar)
+                        mix_frames(interleaved+nc*first, b, g, block_, nc);
+                    else
+                        for(int c=0; c<nc; c++)
+                            if(g[c] != 0) // a voice reaches at most two speakers
+                                mix_samples(planar[c]+first, b, g[c], block_);
+                }
+        }
+    }
+
+
+    matrix
+    mixer::render(float duration)
+    {
+        int nc = channels();
+        if(duration > 0)
+        {
+            int sample_rate = voices_.empty() ? 44100 : voices_[0]->sound.sample_rate();
+            int frames = int(duration * sample_rate);
+            matrix sound = nc == 1 ? matrix(frames) : matrix(frames, nc);
+            if(frames > 0)
+                process(sound.data(), frames);
+            return sound;
+        }
+
+        std::vector<float> samples;
+        while(!finished())
+        {
+            samples.resize(samples.size()+nc*block_size);
+            process(samples.data()+samples.size()-nc*block_size, block_size);
+        }
+        int frames = int(samples.size())/nc;
+        matrix sound = nc == 1 ? matrix(frames) : matrix(frames, nc);
+        if(!samples.empty())
+            std::copy(samples.begin(), samples.end(), sound.data());
+        return sound;
+    }
+};
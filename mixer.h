@@ -0,0 +1,126 @@
+// mixer.h - parallel rendering of many concurrent voices (c) Christian Balkenius 2024
+//
+// Each voice is a compiled patch with a gain. The mixer renders one block at a time: the playing voices
+// are dealt round robin into one task queue per thread, each thread renders the voices in its own queue
+// into their preallocated buffers, and a thread whose queue is empty steals voices from the others.
+// The queues are claimed with atomic counters and need no locks. The calling thread takes part in the
+// work, and when all voices are done it sums the voice buffers into the output in voice order, so the
+// mix does not depend on which thread rendered which voice.
+//
+// Voices are added and removed between calls to process; process itself does not allocate. A voice
+// made with make_voice() is added without allocation as long as no more voices than reserved are playing.
+//
+// The output has one channel for each speaker, mono by default. A voice is placed at an azimuth and a
+// distance; it is panned with constant power between the two speakers on either side of it and
+// attenuated as 1/distance beyond one unit. Stereo is a line from the left to the right speaker, while
+// three or more speakers form a ring. The output is either interleaved, n frames of channels() samples,
+// or planar with a separate buffer for each channel; both are mixed into directly.
+
+#ifndef MIXER
+#define MIXER
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "matrix.h"
+#include "monitor.h"
+#include "patch.h"
+
+namespace ikaros
+{
+    class mixer
+    {
+    public:
+        static constexpr int block_size = patch::block_size;
+        static constexpr int max_channels = 8;
+
+        mixer(int threads=0);  // total number of threads including the caller; 0 = hardware concurrency
+        ~mixer();
+
+        mixer(const mixer &) = delete;
+        mixer & operator=(const mixer &) = delete;
+
+        struct voice
+        {
+            patch               sound;
+            float               gain;
+            long                tag;
+            std::vector<float>  buffer;
+            bool                playing = true;
+            bool                mixed = false;  // rendered in the current block
+            float               azimuth = 0;    // degrees
+            float               distance = 1;
+            float               pan[max_channels] = {1}; // gain of each channel before the gain of the voice
+        };
+
+        static std::unique_ptr<voice> make_voice(patch && sound, float gain=1, float duration=0, uint64_t seed=0, long tag=0); // starts the voice
+
+        void reserve(int voices);
+        int add(std::unique_ptr<voice> v);  // returns the index of the voice; allocates if more voices than reserved are added
+        int add(patch && sound, float gain=1, float duration=0, uint64_t seed=0, long tag=0) { return add(make_voice(std::move(sound), gain, duration, seed, tag)); }
+        void remove_finished();     // drop the voices that have ended; indices of later voices change
+
+        template <typename F>
+        void
+        remove_finished(F && reclaim) // pass the voices that have ended to reclaim(std::unique_ptr<voice> &&), which returns false to keep one for later; neither frees nor allocates
+        {
+            int kept = 0;
+            for(auto & v : voices_)
+                if(v->playing || !reclaim(std::move(v)))
+                    voices_[kept++] = std::move(v);
+            voices_.resize(kept); // the remaining pointers are empty
+        }
+
+        int find(long tag) const;   // index of the first voice with the tag or -1
+        void set_gain(int index, float gain);
+        void stop(int index);       // silence the voice from the next sample on
+        void set_position(int index, float azimuth, float distance=1);
+
+        void set_speakers(const std::vector<float> & azimuths); // degrees clockwise from the front, in order around the listener
+        int channels() const { return int(speakers_.size()); }
+
+        void set_monitor(audio_monitor * monitor) { monitor_ = monitor; } // records the render time of each voice by its tag; nullptr stops
+
+        int threads() const { return int(workers_.size())+1; }
+        int voices() const { return int(voices_.size()); }
+        int playing() const;        // voices that have not ended
+        bool finished() const { return playing() == 0; }
+
+        void process(float * out, int n);           // mix the next n frames, interleaved; voices that have ended are silent
+        void process(float * const * out, int n);   // planar; one buffer of n samples for each channel
+        matrix render(float duration);              // mix until all voices have ended or for duration seconds if it is positive; frames x channels unless mono
+
+    private:
+        struct alignas(64) queue
+        {
+            std::vector<int>    tasks;  // indices of voices
+            int                 count = 0;
+            std::atomic<int>    next{0};
+        };
+
+        void pan(voice & v);
+        void mix(float * interleaved, float * const * planar, int n); // one of the outputs is nullptr
+        void render_voice(voice & v);
+        void worker(int index);
+        void run(int index);        // render the own queue, then steal from the others
+
+        std::vector<std::unique_ptr<voice>> voices_;
+        std::vector<float>                  speakers_{0};
+        std::vector<std::thread>            workers_;
+        std::unique_ptr<queue[]>            queues_;
+
+        std::mutex                          mutex_;
+        std::condition_variable             start_;
+        std::atomic<long>                   generation_{0};
+        std::atomic<int>                    pending_{0};    // workers that have not finished the current block
+        std::atomic<bool>                   stop_{false};
+        int                                 block_ = 0;     // samples in the current block
+        audio_monitor *                     monitor_ = nullptr;
+    };
+};
+
+#endif
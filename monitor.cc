@@ -0,0 +1,159 @@
+// monitor.cc   (c) Christian Balkenius 2024
+
+#include "monitor.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace ikaros
+{
+    double
+    audio_stats::load(double p) const
+    {
+        long total = 0;
+        for(long n : histogram)
+            total += n;
+        if(total == 0)
+            return 0;
+        double rank = p * total;
+        long seen = 0;
+        for(int i=0; i<histogram.size(); i++)
+        {
+            if(seen + histogram[i] >= rank && histogram[i] > 0)
+                return (i + (rank-seen) / histogram[i]) / 16.0; // interpolate within the bin
+            seen += histogram[i];
+        }
+        return histogram.size() / 16.0;
+    }
+
+
+    audio_monitor::audio_monitor(int sample_rate, int voice_slots) :
+        sample_rate_(sample_rate),
+        voice_slots_(std::max(1, voice_slots)),
+        voices_(std::make_unique<slot[]>(std::max(1, voice_slots)))
+    {
+        for(auto & h : histogram_)
+            h.store(0, std::memory_order_relaxed);
+    }
+
+
+    void
+    audio_monitor::raise(std::atomic<int64_t> & x, int64_t v)
+    {
+        int64_t current = x.load(std::memory_order_relaxed);
+        while(v > current && !x.compare_exchange_weak(current, v, std::memory_order_relaxed))
+            ;
+    }
+
+
+    void
+    audio_monitor::start()
+    {
+        origin_.store(now(), std::memory_order_relaxed);
+    }
+
+
+    void
+    audio_monitor::stop()
+    {
+        origin_.store(0, std::memory_order_relaxed);
+        produced_.store(0, std::memory_order_relaxed);
+    }
+
+
+    void
+    audio_monitor::end(int64_t begin, int frames)
+    {
+        int64_t t = now();
+        int64_t duration = t - begin;
+        int64_t deadline = int64_t(frames) * 1000000000 / sample_rate_;
+
+        callbacks_.fetch_add(1, std::memory_order_relaxed);
+        total_ns_.fetch_add(duration, std::memory_order_relaxed);
+        raise(max_ns_, duration);
+        deadline_ns_.store(deadline, std::memory_order_relaxed);
+        if(duration > deadline)
+            misses_.fetch_add(1, std::memory_order_relaxed);
+        int bin = deadline > 0 ? int(std::min<int64_t>(bins-1, 16 * duration / deadline)) : bins-1;
+        histogram_[bin].fetch_add(1, std::memory_order_relaxed);
+
+        // Underruns: the output has played for t - origin and this callback's buffer follows the audio produced before it
+
+        int64_t origin = origin_.load(std::memory_order_relaxed);
+        int64_t produced = produced_.fetch_add(frames, std::memory_order_relaxed);
+        if(origin != 0 && (t - origin) > produced * 1000000000 / sample_rate_)
+        {
+            underruns_.fetch_add(1, std::memory_order_relaxed);
+            origin_.store(t - produced * 1000000000 / sample_rate_, std::memory_order_relaxed); // the output restarts with this buffer
+        }
+    }
+
+
+    void
+    audio_monitor::underrun()
+    {
+        underruns_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+
+    void
+    audio_monitor::voice(long tag, int64_t begin, int64_t end)
+    {
+        int64_t duration = end - begin;
+        raise(voice_max_ns_, duration);
+        if(tag < 0 || tag / voice_slots_ >= UINT32_MAX)
+            return;
+
+        uint64_t key = uint64_t(tag / voice_slots_ + 1) << 32;
+        uint64_t ns = std::clamp<int64_t>(duration, 0, UINT32_MAX);
+        std::atomic<uint64_t> & s = voices_[tag % voice_slots_].state;
+        uint64_t old = s.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            uint64_t next = (old >> 32 << 32) == key ? key | std::max(old & UINT32_MAX, ns) : key | ns; // or a new voice takes over the slot
+            if(next == old || s.compare_exchange_weak(old, next, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+
+    audio_stats
+    audio_monitor::stats() const
+    {
+        audio_stats s;
+        s.callbacks = callbacks_.load(std::memory_order_relaxed);
+        s.misses = misses_.load(std::memory_order_relaxed);
+        s.underruns = underruns_.load(std::memory_order_relaxed);
+        s.mean_ms = s.callbacks > 0 ? total_ns_.load(std::memory_order_relaxed) / 1e6 / s.callbacks : 0;
+        s.max_ms = max_ns_.load(std::memory_order_relaxed) / 1e6;
+        s.deadline_ms = deadline_ns_.load(std::memory_order_relaxed) / 1e6;
+        for(auto & h : histogram_)
+            s.histogram.push_back(h.load(std::memory_order_relaxed));
+        for(int i=0; i<voice_slots_; i++)
+        {
+            uint64_t state = voices_[i].state.load(std::memory_order_relaxed);
+            if(state != 0)
+                s.voices.push_back({long((state >> 32) - 1)*voice_slots_ + i, (state & UINT32_MAX) / 1e6});
+        }
+        s.voice_max_ms = voice_max_ns_.load(std::memory_order_relaxed) / 1e6;
+        return s;
+    }
+
+
+    void
+    audio_monitor::reset()
+    {
+        callbacks_ = 0;
+        misses_ = 0;
+        underruns_ = 0;
+        total_ns_ = 0;
+        max_ns_ = 0;
+        for(auto & h : histogram_)
+            h = 0;
+        for(int i=0; i<voice_slots_; i++)
+        {
+            voices_[i].state = 0;
+        }
+        voice_max_ns_ = 0;
+    }
+};
@@ -0,0 +1,96 @@
+// monitor.h - timing of the audio callback against its deadline (c) Christian Balkenius 2024
+//
+// The audio thread brackets each callback with begin() and end(). The monitor then records:
+//
+//  - the duration of the callback, in a histogram with bins of 1/16 of the deadline up to twice the
+//    deadline; the deadline of a callback is the duration of the audio it produces
+//  - deadline misses, callbacks that took longer than their deadline
+//  - underruns, estimated by comparing the audio produced since start() with the time that has passed;
+//    when the clock has passed the end of the produced audio the output must have run dry
+//  - the longest render time of each voice, when the mixer reports it with voice()
+//
+// Each voice is recorded in the slot of its tag modulo the number of slots, so the tags of the voices that
+// play at the same time must be unique modulo the number of slots; a voice with the tag of another slot
+// takes it over. Tags must be non-negative and less than 2^32 times the number of slots; other tags only
+// count in the longest time over all voices.
+//
+// All recording uses relaxed atomics and never blocks or allocates, so it is safe in the audio thread.
+// Any other thread may read a snapshot with stats() while the audio runs.
+
+#ifndef MONITOR
+#define MONITOR
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ikaros
+{
+    struct audio_stats
+    {
+        long                callbacks = 0;
+        long                misses = 0;         // callbacks over the deadline
+        long                underruns = 0;
+        double              mean_ms = 0;
+        double              max_ms = 0;
+        double              deadline_ms = 0;    // of the last callback
+        std::vector<long>   histogram;          // bin i counts durations in [i/16, (i+1)/16) of the deadline; the last bin also counts longer ones
+        std::vector<std::pair<long, double>>    voices; // voice tag and longest render time in ms
+        double              voice_max_ms = 0;   // over all voices
+
+        double load(double p) const;            // estimated p-quantile of the duration as a fraction of the deadline
+    };
+
+
+    class audio_monitor
+    {
+    public:
+        static const int bins = 32;
+
+        audio_monitor(int sample_rate=44100, int voice_slots=256);
+
+        // Audio thread
+
+        void start();                       // output starts playing now with the audio produced so far
+        void stop();                        // output has stopped; the next start() begins a new stream
+        int64_t begin() const { return now(); }
+        void end(int64_t begin, int frames);
+        void underrun();                    // the caller could not fill a buffer
+        void voice(long tag, int64_t begin, int64_t end);
+
+        // Any thread
+
+        audio_stats stats() const;
+        void reset();
+
+        static int64_t now() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+    private:
+        struct slot // tag / voice_slots_ + 1 in the high half and the longest render time in ns in the low half, in one atomic so that they always belong together; 0 when empty
+        {
+            std::atomic<uint64_t>   state{0};
+        };
+
+        static void raise(std::atomic<int64_t> & x, int64_t v);
+
+        int                         sample_rate_;
+        std::atomic<long>           callbacks_{0};
+        std::atomic<long>           misses_{0};
+        std::atomic<long>           underruns_{0};
+        std::atomic<int64_t>        total_ns_{0};
+        std::atomic<int64_t>        max_ns_{0};
+        std::atomic<int64_t>        deadline_ns_{0};
+        std::atomic<long>           histogram_[bins];
+
+        std::atomic<int64_t>        origin_{0};     // clock time of the first produced sample; 0 before start()
+        std::atomic<int64_t>        produced_{0};   // frames produced in the current stream
+
+        int                         voice_slots_;
+        std::unique_ptr<slot[]>     voices_;        // indexed by tag modulo the number of slots
+        std::atomic<int64_t>        voice_max_ns_{0};
+    };
+};
+
+#endif
@@ -0,0 +1,89 @@
+// mpsc_queue.h - bounded lock-free queue for many producers and one consumer (c) Christian Balkenius 2024
+//
+// The queue is a ring of cells, each with a sequence number that tells whether the cell is free for
+// the producer at a given position or holds a value for the consumer. Producers claim a position with
+// a compare and swap on the tail; the single consumer owns the head. push and pop never block and
+// never allocate; push fails when the queue is full.
+
+#ifndef MPSC_QUEUE
+#define MPSC_QUEUE
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace ikaros
+{
+    template <typename T>
+    class mpsc_queue
+    {
+    public:
+        mpsc_queue(size_t capacity=1024) // rounded up to a power of two
+        {
+            size_t size = 2;
+            while(size < capacity)
+                size *= 2;
+            mask_ = size-1;
+            cells_ = std::make_unique<cell[]>(size);
+            for(size_t i=0; i<size; i++)
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        mpsc_queue(const mpsc_queue &) = delete;
+        mpsc_queue & operator=(const mpsc_queue &) = delete;
+
+        size_t capacity() const { return mask_+1; }
+
+        bool
+        push(T && value) // any thread
+        {
+            size_t position = tail_.load(std::memory_order_relaxed);
+            cell * c;
+            for(;;)
+            {
+                c = &cells_[position & mask_];
+                size_t sequence = c->sequence.load(std::memory_order_acquire);
+                intptr_t d = intptr_t(sequence) - intptr_t(position);
+                if(d == 0)
+                {
+                    if(tail_.compare_exchange_weak(position, position+1, std::memory_order_relaxed))
+                        break;
+                }
+                else if(d < 0)
+                    return false; // full
+                else
+                    position = tail_.load(std::memory_order_relaxed);
+            }
+            c->value = std::move(value);
+            c->sequence.store(position+1, std::memory_order_release);
+            return true;
+        }
+
+        bool
+        pop(T & value) // the consumer thread only
+        {
+            cell & c = cells_[head_ & mask_];
+            if(c.sequence.load(std::memory_order_acquire) != head_+1)
+                return false;
+            value = std::move(c.value);
+            c.sequence.store(head_+mask_+1, std::memory_order_release);
+            head_++;
+            return true;
+        }
+
+    private:
+        struct alignas(64) cell
+        {
+            std::atomic<size_t>     sequence{0};
+            T                       value;
+        };
+
+        std::unique_ptr<cell[]>             cells_;
+        size_t                              mask_ = 0;
+        alignas(64) std::atomic<size_t>     tail_{0};
+        alignas(64) size_t                  head_ = 0;
+    };
+};
+
+#endif
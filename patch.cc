@@ -0,0 +1,917 @@
+// patch.cc   (c) Christian Balkenius 2024
+
+#include "patch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+
+#include "envelope.h"
+#include "control.h"
+#include "philox.h"
+#include "trace.h"
+#include "utilities.h"
+
+namespace ikaros
+{
+    struct patch_context // shared by the nodes during a render
+    {
+        int                 sample_rate;
+        float               duration = 0;
+        long                length = 0;     // samples in the render
+        long                position = 0;   // first sample of the current block
+        philox              rng;
+        std::vector<float>  time;           // time of each sample in the current block
+    };
+
+
+    static void
+    fail(int line, const std::string & message)
+    {
+        throw exception("Patch line "+std::to_string(line)+": "+message);
+    }
+
+
+    static float
+    parse_number(std::string_view s, int line)
+    {
+        std::string n(s);
+        char * end = nullptr;
+        float value = std::strtof(n.c_str(), &end);
+        if(n.empty() || end != n.c_str()+n.size())
+            fail(line, "Expected a number instead of \""+n+"\".");
+        return value;
+    }
+
+
+    static bool
+    is_name(std::string_view s)
+    {
+        if(s.empty() || !(::isalpha(s[0]) || s[0] == '_'))
+            return false;
+        for(char c : s)
+            if(!(::isalnum(c) || c == '_'))
+                return false;
+        return true;
+    }
+
+
+    // A parameter value: a sum of terms that are products of a constant, random factors and node outputs
+
+    struct patch_input
+    {
+        struct term
+        {
+            float                       factor = 1;
+            std::vector<int>            randoms;    // indices of the random factors
+            std::vector<float>          lows;
+            std::vector<float>          highs;
+            std::vector<std::string>    names;
+            std::vector<patch_node *>   nodes;
+            float                       scale = 1;  // factor times the random factors for this render
+        };
+
+        std::vector<term>   terms;
+        std::vector<float>  buffer;
+        float               value = 0;      // when constant
+        const float *       direct = nullptr; // output of a single node used as it is
+
+        patch_input(float v=0) : value(v) { terms.push_back(term()); terms.back().factor = v; }
+
+        bool
+        constant() const
+        {
+            for(auto & t : terms)
+                if(!t.names.empty())
+                    return false;
+            return true;
+        }
+
+        float
+        bound() const // largest magnitude of a constant value over all renders
+        {
+            float b = 0;
+            for(auto & t : terms)
+            {
+                float m = std::fabs(t.factor);
+                for(int i=0; i<t.randoms.size(); i++)
+                    m *= std::max(std::fabs(t.lows[i]), std::fabs(t.highs[i]));
+                b += m;
+            }
+            return b;
+        }
+
+        void parse(std::string_view s, int line, int & random_count);
+        void start(const philox & rng);
+        const float * get(int n);
+    };
+
+
+    struct patch_node
+    {
+        std::string                 name;
+        std::string                 type;
+        int                         line = 0;
+        std::vector<float>          output;
+        std::vector<float>          local_time;     // time since the start of the last pulse; only for pulses
+        std::vector<patch_input *>  inputs;         // all inputs, for dependencies and evaluation
+        std::vector<std::string>    keys;           // parameters set in the patch
+        std::string                 sync_name;
+        patch_node *                sync = nullptr;
+        int                         index = 0;      // random stream
+
+        virtual ~patch_node() {}
+
+        virtual patch_input * input(const std::string & key) { return nullptr; }
+        virtual bool option(const std::string & key, std::string_view value) { return false; }
+        virtual void add(std::string_view value, int & random_count) { fail(line, "Unexpected value \""+std::string(value)+"\"."); }
+        virtual void allocate() { output.assign(patch::block_size, 0); }
+        virtual void check() {}
+        virtual void start(patch_context & c) {}
+        virtual void process(patch_context & c, int n) = 0;
+
+        void
+        require_constant(std::initializer_list<const char *> keys)
+        {
+            for(auto k : keys)
+                if(!input(k)->constant())
+                    fail(line, "The "+std::string(k)+" of a "+type+" must not depend on other nodes.");
+        }
+
+        const float *
+        time(patch_context & c) // the time of each sample for this node
+        {
+            return sync ? sync->local_time.data() : c.time.data();
+        }
+    };
+
+
+    void
+    patch_input::parse(std::string_view s, int line, int & random_count)
+    {
+        terms.clear();
+        if(s.empty())
+            fail(line, "Missing value.");
+
+        // Split at '+' that is not part of a number such as 1e+3
+
+        std::vector<std::string_view> parts;
+        size_t start = 0;
+        for(size_t i=0; i<s.size(); i++)
+            if(s[i] == '+' && i > start && !(i >= 2 && (s[i-1] == 'e' || s[i-1] == 'E') && (::isdigit(s[i-2]) || s[i-2] == '.')))
+            {
+                parts.push_back(s.substr(start, i-start));
+                start = i+1;
+            }
+        parts.push_back(s.substr(start));
+
+        for(auto part : parts)
+        {
+            term t;
+            for(auto factor : split_range(part, "*"))
+            {
+                if(factor.empty())
+                    fail(line, "Malformed value \""+std::string(s)+"\".");
+                if(factor.substr(0, 7) == "random(" && factor.back() == ')')
+                {
+                    auto args = split_view(factor.substr(7, factor.size()-8), ",");
+                    if(args.size() != 2)
+                        fail(line, "random() takes two numbers.");
+                    t.randoms.push_back(random_count++);
+                    t.lows.push_back(parse_number(args[0], line));
+                    t.highs.push_back(parse_number(args[1], line));
+                }
+                else if(is_name(factor))
+                    t.names.push_back(std::string(factor));
+                else
+                    t.factor *= parse_number(factor, line);
+            }
+            terms.push_back(t);
+        }
+    }
+
+
+    void
+    patch_input::start(const philox & rng)
+    {
+        value = 0;
+        for(auto & t : terms)
+        {
+            t.scale = t.factor;
+            for(int i=0; i<t.randoms.size(); i++)
+                t.scale *= t.lows[i]+(t.highs[i]-t.lows[i])*rng.uniform(t.randoms[i]);
+            if(t.nodes.empty())
+                value += t.scale;
+        }
+
+        direct = nullptr;
+        if(terms.size() == 1 && terms[0].nodes.size() == 1 && terms[0].scale == 1)
+            direct = terms[0].nodes[0]->output.data();
+        else if(constant())
+            std::fill(buffer.begin(), buffer.end(), value);
+    }
+
+
+    const float *
+    patch_input::get(int n)
+    {
+        if(direct)
+            return direct;
+        float * b = buffer.data();
+        if(constant())
+            return b;
+
+        std::fill(b, b+n, value);
+        for(auto & t : terms)
+        {
+            if(t.nodes.empty())
+                continue;
+            float s = t.scale;
+            const float * x = t.nodes[0]->output.data();
+            if(t.nodes.size() == 1)
+                for(int i=0; i<n; i++)
+                    b[i] += s*x[i];
+            else if(t.nodes.size() == 2)
+            {
+                const float * y = t.nodes[1]->output.data();
+                for(int i=0; i<n; i++)
+                    b[i] += s*x[i]*y[i];
+            }
+            else
+                for(int i=0; i<n; i++)
+                {
+                    float p = s;
+                    for(auto * node : t.nodes)
+                        p *= node->output[i];
+                    b[i] += p;
+                }
+        }
+        return b;
+    }
+
+
+    // Nodes
+
+    struct sine_node : patch_node
+    {
+        patch_input         freq{440};
+        patch_input         amp{1};
+        bool                absolute = false;
+        bool                bandlimit = true;
+        std::vector<float>  harmonics{1};
+        double              phase = 0;      // cycles; integrated mode
+        float               last_time = 0;
+        float               last_freq = 0;  // absolute mode
+
+        sine_node() { inputs = {&freq, &amp}; }
+
+        patch_input *
+        input(const std::string & key) override
+        {
+            return key == "freq" ? &freq : key == "amp" ? &amp : nullptr;
+        }
+
+        bool
+        option(const std::string & key, std::string_view value) override
+        {
+            if(key == "phase")
+            {
+                if(value != "absolute" && value != "integrated")
+                    fail(line, "phase must be absolute or integrated.");
+                absolute = value == "absolute";
+                return true;
+            }
+            if(key == "bandlimit")
+            {
+                if(value != "on" && value != "off")
+                    fail(line, "bandlimit must be on or off.");
+                bandlimit = value == "on";
+                return true;
+            }
+            if(key == "harmonics")
+            {
+                harmonics.clear();
+                for(auto h : split_range(value, ","))
+                    harmonics.push_back(parse_number(h, line));
+                return true;
+            }
+            return false;
+        }
+
+        void
+        start(patch_context & c) override
+        {
+            phase = 0;
+            last_time = 0;
+            last_freq = -1;
+        }
+
+        float
+        gain(patch_context & c, int h, float f) // of partial h with the instantaneous frequency f of the fundamental
+        {
+            return harmonics[h] * (bandlimit ? band_limit((h+1)*f, c.sample_rate) : 1);
+        }
+
+        void
+        process(patch_context & c, int n) override
+        {
+            const float * f = freq.get(n);
+            const float * a = amp.get(n);
+            const float * t = time(c);
+            float * out = output.data();
+            int partials = harmonics.size();
+
+            if(absolute)
+                for(int i=0; i<n; i++)
+                {
+                    if(last_freq < 0)
+                        last_freq = f[i];
+                    float fi = f[i] + t[i]*(f[i]-last_freq)*c.sample_rate; // d(f*t)/dt
+                    last_freq = f[i];
+                    float s = 0;
+                    for(int h=0; h<partials; h++)
+                        if(float g = gain(c, h, fi); g != 0)
+                            s += g * std::sin(2 * (h+1) * M_PI * f[i] * t[i]);
+                    out[i] = a[i]*s;
+                }
+            else
+            {
+                for(int i=0; i<n; i++)
+                {
+                    if(sync && t[i] < last_time) // new pulse
+                        phase = 0;
+                    last_time = t[i];
+                    float s = 0;
+                    for(int h=0; h<partials; h++)
+                        if(float g = gain(c, h, f[i]); g != 0)
+                            s += g * std::sin(2 * (h+1) * M_PI * phase);
+                    out[i] = a[i]*s;
+                    phase += f[i]/c.sample_rate;
+                    phase -= std::floor(phase);
+                }
+            }
+        }
+    };
+
+
+    struct chirp_node : patch_node
+    {
+        patch_input     base{0};
+        patch_input     range{1};
+        patch_input     rate{1};
+        patch_input     phase{0};
+        patch_input     cycles{0};
+        bool            has_cycles = false; // rate is given as cycles over the duration
+
+        chirp_node() { inputs = {&base, &range, &rate, &phase, &cycles}; }
+
+        patch_input *
+        input(const std::string & key) override
+        {
+            return key == "base" ? &base : key == "range" ? &range : key == "rate" ? &rate : key == "phase" ? &phase : key == "cycles" ? &cycles : nullptr;
+        }
+
+        void
+        check() override
+        {
+            require_constant({"cycles"});
+            has_cycles = std::find(keys.begin(), keys.end(), "cycles") != keys.end();
+        }
+
+        void
+        process(patch_context & c, int n) override
+        {
+            float * out = output.data();
+            float r = has_cycles ? cycles.value/c.duration : rate.value;
+
+            if(!sync && base.constant() && range.constant() && phase.constant() && (has_cycles || rate.constant())) // slow modulator at control rate
+            {
+                float b = base.value;
+                float d = range.value;
+                float p = phase.value;
+                float sr = c.sample_rate;
+                int first = c.position;
+                control_rate(first, first+n, [&](int j) {
+                    return b + d * std::sin(2 * float(M_PI) * r * (float(j)/sr) + p);
+                }, [&](int i, float m) {
+                    out[i-first] = m;
+                });
+                return;
+            }
+
+            const float * b = base.get(n);
+            const float * d = range.get(n);
+            const float * f = has_cycles ? nullptr : rate.get(n);
+            const float * p = phase.get(n);
+            const float * t = time(c);
+            for(int i=0; i<n; i++)
+                out[i] = b[i] + d[i] * std::sin(2 * float(M_PI) * (f ? f[i] : r) * t[i] + p[i]);
+        }
+    };
+
+
+    struct ramp_node : patch_node
+    {
+        patch_input     from{0};
+        patch_input     to{1};
+
+        ramp_node() { inputs = {&from, &to}; }
+
+        patch_input *
+        input(const std::string & key) override
+        {
+            return key == "from" ? &from : key == "to" ? &to : nullptr;
+        }
+
+        void
+        process(patch_context & c, int n) override
+        {
+            const float * a = from.get(n);
+            const float * b = to.get(n);
+            const float * t = c.time.data();
+            float * out = output.data();
+            float scale = c.duration > 0 ? 1/c.duration : 0;
+            for(int i=0; i<n; i++)
+                out[i] = a[i] + (b[i]-a[i]) * t[i] * scale;
+        }
+    };
+
+
+    struct noise_node : patch_node
+    {
+        patch_input     amp{1};
+
+        noise_node() { inputs = {&amp}; }
+
+        patch_input *
+        input(const std::string & key) override
+        {
+            return key == "amp" ? &amp : nullptr;
+        }
+
+        void
+        process(patch_context & c, int n) override
+        {
+            const float * a = amp.get(n);
+            float * out = output.data();
+            c.rng.fill_uniform(out, n, c.position, index);
+            for(int i=0; i<n; i++)
+                out[i] = a[i] * (out[i] * 2 - 1);
+        }
+    };
+
+
+    struct envelope_node : patch_node
+    {
+        patch_input     attack{0.01f};
+        patch_input     decay{0};
+        patch_input     sustain{1};
+        patch_input     release{0.1f};
+        envelope::curve curve = envelope::linear;
+        envelope        adsr;
+
+        envelope_node() { inputs = {&attack, &decay, &sustain, &release}; }
+
+        patch_input *
+        input(const std::string & key) override
+        {
+            return key == "attack" ? &attack : key == "decay" ? &decay : key == "sustain" ? &sustain : key == "release" ? &release : nullptr;
+        }
+
+        bool
+        option(const std::string & key, std::string_view value) override
+        {
+            if(key != "curve")
+                return false;
+            if(value != "linear" && value != "exponential")
+                fail(line, "curve must be linear or exponential.");
+            curve = value == "linear" ? envelope::linear : envelope::exponential;
+            return true;
+        }
+
+        void
+        check() override
+        {
+            require_constant({"attack", "decay", "sustain", "release"});
+        }
+
+        void
+        start(patch_context & c) override
+        {
+            adsr.set_sample_rate(c.sample_rate);
+            adsr.set(attack.value, decay.value, sustain.value, release.value, curve);
+            adsr.reset();
+            adsr.note_on(std::max(0L, c.length - std::lround(release.value * c.sample_rate)));
+        }
+
+        void
+        process(patch_context & c, int n) override
+        {
+            adsr.process(output.data(), n);
+        }
+    };
+
+
+    struct pulses_node : patch_node
+    {
+        static const int    max_pulses = 65536;
+        patch_input         count{4};
+        patch_input         spacing{0.2f};
+        patch_input         attack{0.01f};
+        patch_input         release{0.05f};
+        patch_input         jitter{0};
+        envelope            adsr;
+        std::vector<long>   firsts;     // pulse p covers the samples [firsts[p], lasts[p])
+        std::vector<long>   lasts;
+        std::vector<float>  starts;     // start time of each pulse
+        std::vector<float>  noise;
+        int                 pulse = 0;  // current or next pulse
+
+        pulses_node() { inputs = {&count, &spacing, &attack, &release, &jitter}; }
+
+        patch_input *
+        input(const std::string & key) override
+        {
+            return key == "count" ? &count : key == "spacing" ? &spacing : key == "attack" ? &attack : key == "release" ? &release : key == "jitter" ? &jitter : nullptr;
+        }
+
+        void
+        allocate() override
+        {
+            patch_node::allocate();
+            local_time.assign(patch::block_size, 0);
+            noise.assign(patch::block_size, 0);
+            int n = int(count.bound())+1; // and one for the rounding of the count
+            firsts.reserve(n);
+            lasts.reserve(n);
+            starts.reserve(n);
+        }
+
+        void
+        check() override
+        {
+            require_constant({"count", "spacing", "attack", "release", "jitter"});
+            if(count.bound() > max_pulses)
+                fail(line, "The count of a pulses must not be above "+std::to_string(max_pulses)+".");
+        }
+
+        void
+        start(patch_context & c) override
+        {
+            int n = std::clamp(int(count.value), 1, int(firsts.capacity())); // within the reserve of allocate()
+            float pulse_duration = c.duration / n;
+            float pulse_spacing = pulse_duration * spacing.value;
+
+            firsts.clear();
+            lasts.clear();
+            starts.clear();
+            long first = 0;
+            for(int p=0; p<n; p++)
+            {
+                float pulse_start = p * pulse_duration;
+                float pulse_end = pulse_start + pulse_duration - pulse_spacing;
+                while(first < c.length && float(first) / c.sample_rate < pulse_start)
+                    first++;
+                long last = first;
+                while(last < c.length && float(last) / c.sample_rate < pulse_end)
+                    last++;
+                firsts.push_back(first);
+                lasts.push_back(last);
+                starts.push_back(pulse_start);
+            }
+            pulse = 0;
+            adsr.set_sample_rate(c.sample_rate);
+            adsr.set(attack.value, 0, 1, release.value);
+            adsr.reset();
+        }
+
+        void
+        process(patch_context & c, int n) override
+        {
+            float * out = output.data();
+            float * lt = local_time.data();
+            const float * t = c.time.data();
+            long position = c.position;
+            float j = jitter.value;
+
+            int i = 0;
+            while(i < n)
+            {
+                while(pulse < firsts.size() && position+i >= lasts[pulse])
+                    pulse++;
+
+                float pulse_start = pulse < starts.size() && position+i >= firsts[pulse] ? starts[pulse] : pulse > 0 ? starts[pulse-1] : 0;
+                long span_end = pulse < firsts.size() ? (position+i < firsts[pulse] ? firsts[pulse] : lasts[pulse]) : position+n;
+                int span = int(std::min<long>(span_end, position+n) - (position+i));
+
+                for(int k=i; k<i+span; k++)
+                    lt[k] = t[k] - pulse_start;
+
+                if(pulse < firsts.size() && position+i >= firsts[pulse]) // inside a pulse
+                {
+                    if(position+i == firsts[pulse])
+                    {
+                        adsr.reset();
+                        adsr.note_on(std::max(0L, lasts[pulse] - firsts[pulse] - std::lround(release.value * c.sample_rate)));
+                    }
+                    adsr.process(out+i, span);
+                    if(j != 0)
+                    {
+                        float * u = noise.data();
+                        c.rng.fill_uniform(u+i, span, position+i, index);
+                        for(int k=i; k<i+span; k++)
+                            out[k] *= 1.0f + j * (u[k] - 0.5f);
+                    }
+                }
+                else
+                    std::fill(out+i, out+i+span, 0.0f);
+
+                i += span;
+            }
+        }
+    };
+
+
+    struct mix_node : patch_node
+    {
+        std::vector<std::unique_ptr<patch_input>>   sources;
+        patch_input                                 gain{1};
+
+        mix_node() { inputs = {&gain}; }
+
+        patch_input *
+        input(const std::string & key) override
+        {
+            return key == "gain" ? &gain : nullptr;
+        }
+
+        void
+        add(std::string_view value, int & random_count) override
+        {
+            sources.push_back(std::make_unique<patch_input>());
+            sources.back()->parse(value, line, random_count);
+            inputs.push_back(sources.back().get());
+        }
+
+        void
+        process(patch_context & c, int n) override
+        {
+            float * out = output.data();
+            std::fill(out, out+n, 0.0f);
+            for(auto & s : sources)
+            {
+                const float * x = s->get(n);
+                for(int i=0; i<n; i++)
+                    out[i] += x[i];
+            }
+            const float * g = gain.get(n);
+            for(int i=0; i<n; i++)
+                out[i] *= g[i];
+        }
+    };
+
+
+    static std::unique_ptr<patch_node>
+    make_node(std::string_view type)
+    {
+        if(type == "sine")      return std::make_unique<sine_node>();
+        if(type == "chirp")     return std::make_unique<chirp_node>();
+        if(type == "ramp")      return std::make_unique<ramp_node>();
+        if(type == "noise")     return std::make_unique<noise_node>();
+        if(type == "envelope")  return std::make_unique<envelope_node>();
+        if(type == "pulses")    return std::make_unique<pulses_node>();
+        if(type == "mix")       return std::make_unique<mix_node>();
+        return nullptr;
+    }
+
+
+    // Patch
+
+    patch::patch(const std::string & text, int sample_rate) : sample_rate_(sample_rate), context_(std::make_unique<patch_context>())
+    {
+        parse(text);
+        compile();
+    }
+
+
+    patch::patch(patch &&) = default;
+    patch & patch::operator=(patch &&) = default;
+    patch::~patch() = default;
+
+
+    patch
+    patch::load(const std::string & filename, int sample_rate)
+    {
+        std::ifstream file(filename);
+        if(!file)
+            throw exception("Could not open patch \""+filename+"\".");
+        std::stringstream text;
+        text << file.rdbuf();
+        return patch(text.str(), sample_rate);
+    }
+
+
+    void
+    patch::parse(const std::string & text)
+    {
+        int line = 0;
+        for(std::string_view row : split_view(text, "\n"))
+        {
+            line++;
+            row = trim_view(peek_head_view(row, "#"));
+            if(row.empty())
+                continue;
+
+            std::vector<std::string_view> tokens = split_view(row, "");
+            if(tokens[0] == "duration")
+            {
+                if(tokens.size() != 2)
+                    fail(line, "Expected duration <seconds>.");
+                duration_ = parse_number(tokens[1], line);
+                if(duration_ <= 0)
+                    fail(line, "The duration must be positive.");
+                continue;
+            }
+
+            if(tokens.size() < 3 || tokens[1] != "=" || !is_name(tokens[0]))
+                fail(line, "Expected <name> = <type> <parameters>.");
+
+            std::string name(tokens[0]);
+            for(auto & n : nodes_)
+                if(n->name == name)
+                    fail(line, "Node \""+name+"\" is already defined on line "+std::to_string(n->line)+".");
+
+            std::unique_ptr<patch_node> node = make_node(tokens[2]);
+            if(!node)
+                fail(line, "Unknown node type \""+std::string(tokens[2])+"\".");
+            node->name = name;
+            node->type = std::string(tokens[2]);
+            node->line = line;
+
+            for(int i=3; i<tokens.size(); i++)
+            {
+                std::string_view token = tokens[i];
+                size_t eq = token.find('=');
+                if(eq == std::string_view::npos)
+                {
+                    node->add(token, random_count_);
+                    continue;
+                }
+                std::string key(token.substr(0, eq));
+                std::string_view value = token.substr(eq+1);
+                node->keys.push_back(key);
+                if(key == "sync" && (node->type == "sine" || node->type == "chirp"))
+                    node->sync_name = std::string(value);
+                else if(patch_input * in = node->input(key))
+                    in->parse(value, line, random_count_);
+                else if(!node->option(key, value))
+                    fail(line, "Unknown parameter \""+key+"\" for "+node->type+".");
+            }
+            node->check();
+            nodes_.push_back(std::move(node));
+        }
+    }
+
+
+    void
+    patch::compile()
+    {
+        std::map<std::string, patch_node *> names;
+        for(auto & n : nodes_)
+            names[n->name] = n.get();
+
+        auto find = [&](const std::string & name, int line)
+        {
+            auto it = names.find(name);
+            if(it == names.end())
+                fail(line, "Unknown node \""+name+"\".");
+            return it->second;
+        };
+
+        for(int i=0; i<nodes_.size(); i++)
+        {
+            patch_node * n = nodes_[i].get();
+            n->index = i+1; // stream 0 is for the random parameters
+            for(auto * in : n->inputs)
+                for(auto & t : in->terms)
+                {
+                    t.nodes.clear();
+                    for(auto & name : t.names)
+                        t.nodes.push_back(find(name, n->line));
+                }
+            if(!n->sync_name.empty())
+            {
+                n->sync = find(n->sync_name, n->line);
+                if(n->sync->type != "pulses")
+                    fail(n->line, "sync must name a pulses node.");
+            }
+        }
+
+        auto out = names.find("out");
+        if(out == names.end())
+            throw exception("Patch has no node named out.");
+
+        // Depth first search from the output; a node is added after all its inputs
+
+        std::map<patch_node *, int> state; // 1 = visiting, 2 = done
+        std::function<void(patch_node *)> visit = [&](patch_node * n)
+        {
+            if(state[n] == 2)
+                return;
+            if(state[n] == 1)
+                fail(n->line, "Node \""+n->name+"\" depends on itself.");
+            state[n] = 1;
+            for(auto * in : n->inputs)
+                for(auto & t : in->terms)
+                    for(auto * m : t.nodes)
+                        visit(m);
+            if(n->sync)
+                visit(n->sync);
+            state[n] = 2;
+            order_.push_back(n);
+        };
+        order_.clear();
+        visit(out->second);
+
+        for(auto * n : order_)
+        {
+            n->allocate();
+            for(auto * in : n->inputs)
+                in->buffer.assign(block_size, 0);
+        }
+        context_->sample_rate = sample_rate_;
+        context_->time.assign(block_size, 0);
+    }
+
+
+    std::vector<std::string>
+    patch::order() const
+    {
+        std::vector<std::string> names;
+        for(auto * n : order_)
+            names.push_back(n->name);
+        return names;
+    }
+
+
+    void
+    patch::start(float duration, uint64_t seed)
+    {
+        patch_context & c = *context_;
+        c.duration = duration > 0 ? duration : duration_;
+        c.length = long(c.duration * sample_rate_);
+        c.position = 0;
+        c.rng.seed(seed);
+
+        for(auto * n : order_)
+        {
+            for(auto * in : n->inputs)
+                in->start(c.rng);
+            n->start(c);
+        }
+    }
+
+
+    bool
+    patch::finished() const
+    {
+        return context_->position >= context_->length;
+    }
+
+
+    int
+    patch::process(float * out, int n)
+    {
+        patch_context & c = *context_;
+        patch_node * output = order_.back();
+        int written = 0;
+        while(written < n && c.position < c.length)
+        {
+            TRACE_SCOPE("patch::block");
+            int span = int(std::min<long>({long(block_size), long(n-written), c.length-c.position}));
+            for(int i=0; i<span; i++)
+                c.time[i] = float(c.position+i) / sample_rate_;
+            for(auto * node : order_)
+                node->process(c, span);
+            std::copy(output->output.data(), output->output.data()+span, out+written);
+            written += span;
+            c.position += span;
+        }
+        return written;
+    }
+
+
+    matrix
+    patch::render(float duration, uint64_t seed)
+    {
+        start(duration, seed);
+        matrix sound(int(context_->length));
+        if(context_->length > 0)
+            process(sound.data(), context_->length);
+        return sound;
+    }
+};
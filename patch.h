@@ -0,0 +1,84 @@
+// patch.h - declarative sound patches compiled into a processing graph (c) Christian Balkenius 2024
+//
+// A patch is a text with one node on each line:
+//
+//      # happy chirp
+//      duration 1
+//      sweep = chirp range=200 rate=random(4.8,8)
+//      tone = sine freq=1500+sweep phase=absolute
+//      env = envelope attack=0.05 release=0.1
+//      out = mix tone gain=0.3*env
+//
+// Parameter values are sums of products of numbers, random(low,high) and node names, written without spaces.
+// Random values are drawn from the seed when a render starts. The node named out is the output of the patch.
+// Times are in seconds and frequencies in Hz.
+//
+//      sine freq=440 amp=1 phase=integrated|absolute harmonics=1,0.5,... bandlimit=on|off sync=<pulses>
+//                      absolute computes the phase as 2*pi*freq*t like R2D2Synth; harmonics are the amplitudes of the partials;
+//                      bandlimit fades out each partial as its instantaneous frequency nears the Nyquist frequency
+//      chirp base=0 range=1 rate=1 cycles=<n> phase=0 sync=<pulses>
+//                      base+range*sin(2*pi*rate*t+phase); cycles sets the rate to n cycles over the duration
+//      ramp from=0 to=1                    linear over the duration
+//      noise amp=1                         uniform in [-amp, amp)
+//      envelope attack=0.01 decay=0 sustain=1 release=0.1 curve=linear|exponential
+//                      released at the end of the sound
+//      pulses count=4 spacing=0.2 attack=0.01 release=0.05 jitter=0
+//                      at most 65536 evenly spaced pulses with a random amplitude; spacing is the silent part of each period;
+//                      a sine or chirp synced to the pulses restarts its time at every pulse
+//      mix <node> <node> ... gain=1        sum of the inputs times gain
+//
+// When a patch is compiled the nodes that the output depends on are sorted so that every node runs after its
+// inputs, and all buffers are allocated. Rendering then runs each node over a block of samples in turn with no
+// allocation.
+
+#ifndef PATCH
+#define PATCH
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+
+namespace ikaros
+{
+    struct patch_node;
+    struct patch_context;
+
+    class patch
+    {
+    public:
+        static const int block_size = 256;
+
+        patch(const std::string & text, int sample_rate=44100); // parses and compiles; throws ikaros::exception with the line number on errors
+        patch(patch &&);
+        patch & operator=(patch &&);
+        ~patch();
+
+        static patch load(const std::string & filename, int sample_rate=44100);
+
+        float duration() const { return duration_; }    // default duration from the patch
+        int sample_rate() const { return sample_rate_; }
+        std::vector<std::string> order() const;         // names of the nodes in processing order
+
+        void start(float duration=0, uint64_t seed=0);  // begin a render; 0 uses the duration of the patch
+        int process(float * out, int n);                // render the next n samples; returns the number written, which is less at the end
+        bool finished() const;
+
+        matrix render(float duration=0, uint64_t seed=0);
+
+    private:
+        void parse(const std::string & text);
+        void compile();
+
+        int                                         sample_rate_;
+        float                                       duration_ = 1;
+        std::vector<std::unique_ptr<patch_node>>    nodes_;     // as written
+        std::vector<patch_node *>                   order_;     // nodes needed for the output in processing order
+        std::unique_ptr<patch_context>              context_;
+        int                                         random_count_ = 0;
+    };
+};
+
+#endif
@@ -0,0 +1,446 @@
+// pcm.cc   (c) Christian Balkenius 2024
+//
+// Each generator of the dither is a 32-bit xorshift; the difference of the two 16-bit halves of its
+// output is a triangular value in (-1, 1). Rounding is to nearest even in all kernels, and NaN is set to
+// zero before scaling, with an ordered compare in the SIMD kernels, so that all kernels encode it alike.
+// The SIMD kernels handle complete groups of eight samples; the scalar code does the rest.
+// x86 kernels are compiled with target attributes and selected at run time.
+
+#include "pcm.h"
+
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "exceptions.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PCM_X86
+#include <immintrin.h>
+#endif
+
+namespace ikaros
+{
+    struct pcm_limits
+    {
+        float   scale;
+        float   lo;
+        float   hi;
+    };
+
+    static pcm_limits
+    limits(pcm_format format)
+    {
+        switch(format)
+        {
+            case pcm_format::s16: return {32768.0f, -32768.0f, 32767.0f};
+            case pcm_format::s24: return {8388608.0f, -8388608.0f, 8388607.0f};
+            default: return {2147483648.0f, -2147483648.0f, 2147483520.0f}; // the largest float below 2^31
+        }
+    }
+
+
+    pcm_dither::pcm_dither(uint64_t seed)
+    {
+        for(int i=0; i<8; i++) // splitmix64 spreads the seed over the generators
+        {
+            uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            z ^= z >> 31;
+            state[i] = uint32_t(z) ? uint32_t(z) : 1; // zero is a fixed point of xorshift
+        }
+    }
+
+    // Scalar kernels
+
+    static inline float
+    dither_value(uint32_t & x)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return (float(x & 0xffff) - float(x >> 16)) * (1.0f/65536);
+    }
+
+
+    static inline int32_t
+    quantize(float x, const pcm_limits & l, float d)
+    {
+        x = x == x ? x : 0; // NaN
+        float y = x * l.scale + d;
+        y = y > l.lo ? y : l.lo;
+        y = y < l.hi ? y : l.hi;
+        return int32_t(std::nearbyint(y));
+    }
+
+
+    static void
+    encode_scalar(const float * in, unsigned char * out, size_t n, pcm_format format, uint32_t * state) // state is nullptr without dither
+    {
+        pcm_limits l = limits(format);
+        for(size_t i=0; i<n; i++)
+        {
+            int32_t v = quantize(in[i], l, state ? dither_value(state[i & 7]) : 0);
+            if(format == pcm_format::s16)
+            {
+                int16_t s = v;
+                std::memcpy(out+2*i, &s, 2);
+            }
+            else if(format == pcm_format::s24)
+            {
+                out[3*i] = v;
+                out[3*i+1] = v >> 8;
+                out[3*i+2] = v >> 16;
+            }
+            else
+                std::memcpy(out+4*i, &v, 4);
+        }
+    }
+
+
+    static void
+    decode_scalar(const unsigned char * in, float * out, size_t n, pcm_format format)
+    {
+        for(size_t i=0; i<n; i++)
+        {
+            if(format == pcm_format::s16)
+            {
+                int16_t s;
+                std::memcpy(&s, in+2*i, 2);
+                out[i] = s * (1.0f/32768);
+            }
+            else if(format == pcm_format::s24)
+            {
+                int32_t v = int32_t(uint32_t(in[3*i]) << 8 | uint32_t(in[3*i+1]) << 16 | uint32_t(in[3*i+2]) << 24) >> 8;
+                out[i] = v * (1.0f/8388608);
+            }
+            else
+            {
+                int32_t v;
+                std::memcpy(&v, in+4*i, 4);
+                out[i] = v * (1.0f/2147483648.0f);
+            }
+        }
+    }
+
+    // SIMD kernels; each returns the number of samples converted, which is a multiple of eight when encoding
+
+#ifdef PCM_X86
+
+    __attribute__((target("sse4.1")))
+    static inline __m128
+    dither_sse41(__m128i & x)
+    {
+        x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+        x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+        x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+        __m128 a = _mm_cvtepi32_ps(_mm_and_si128(x, _mm_set1_epi32(0xffff)));
+        __m128 b = _mm_cvtepi32_ps(_mm_srli_epi32(x, 16));
+        return _mm_mul_ps(_mm_sub_ps(a, b), _mm_set1_ps(1.0f/65536));
+    }
+
+
+    __attribute__((target("sse4.1")))
+    static inline __m128i
+    quantize_sse41(const float * p, __m128 scale, __m128 lo, __m128 hi, __m128i * state) // no dither if state is nullptr
+    {
+        __m128 x = _mm_loadu_ps(p);
+        __m128 y = _mm_mul_ps(_mm_and_ps(x, _mm_cmpord_ps(x, x)), scale);
+        if(state)
+            y = _mm_add_ps(y, dither_sse41(*state));
+        y = _mm_min_ps(_mm_max_ps(y, lo), hi);
+        return _mm_cvtps_epi32(y);
+    }
+
+
+    __attribute__((target("sse4.1")))
+    static size_t
+    encode_sse41(const float * in, unsigned char * out, size_t n, pcm_format format, uint32_t * state)
+    {
+        pcm_limits l = limits(format);
+        const __m128 scale = _mm_set1_ps(l.scale);
+        const __m128 lo = _mm_set1_ps(l.lo);
+        const __m128 hi = _mm_set1_ps(l.hi);
+        const __m128i pack24 = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        __m128i s0 = state ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(state)) : _mm_setzero_si128();
+        __m128i s1 = state ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(state+4)) : _mm_setzero_si128();
+
+        __m128i * d0 = state ? &s0 : nullptr;
+        __m128i * d1 = state ? &s1 : nullptr;
+
+        size_t i = 0;
+        if(format == pcm_format::s16)
+            for(; i+8 <= n; i+=8)
+            {
+                __m128i a = quantize_sse41(in+i, scale, lo, hi, d0);
+                __m128i b = quantize_sse41(in+i+4, scale, lo, hi, d1);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out+2*i), _mm_packs_epi32(a, b));
+            }
+        else if(format == pcm_format::s24)
+            for(; i+10 <= n; i+=8) // writes 28 bytes and uses 24
+            {
+                __m128i a = _mm_shuffle_epi8(quantize_sse41(in+i, scale, lo, hi, d0), pack24);
+                __m128i b = _mm_shuffle_epi8(quantize_sse41(in+i+4, scale, lo, hi, d1), pack24);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out+3*i), a);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out+3*i+12), b);
+            }
+        else
+            for(; i+8 <= n; i+=8)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out+4*i), quantize_sse41(in+i, scale, lo, hi, d0));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out+4*i+16), quantize_sse41(in+i+4, scale, lo, hi, d1));
+            }
+
+        if(state)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state), s0);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state+4), s1);
+        }
+        return i;
+    }
+
+
+    __attribute__((target("sse4.1")))
+    static size_t
+    decode_sse41(const unsigned char * in, float * out, size_t n, pcm_format format)
+    {
+        const __m128i unpack24 = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        size_t i = 0;
+        if(format == pcm_format::s16)
+            for(; i+4 <= n; i+=4)
+            {
+                __m128i v = _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in+2*i)));
+                _mm_storeu_ps(out+i, _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f/32768)));
+            }
+        else if(format == pcm_format::s24)
+            for(; i+6 <= n; i+=4) // reads 16 bytes and uses 12
+            {
+                __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in+3*i)), unpack24);
+                v = _mm_srai_epi32(v, 8);
+                _mm_storeu_ps(out+i, _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f/8388608)));
+            }
+        else
+            for(; i+4 <= n; i+=4)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+4*i));
+                _mm_storeu_ps(out+i, _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f/2147483648.0f)));
+            }
+        return i;
+    }
+
+
+    __attribute__((target("avx2")))
+    static inline __m256
+    dither_avx2(__m256i & x)
+    {
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+        __m256 a = _mm256_cvtepi32_ps(_mm256_and_si256(x, _mm256_set1_epi32(0xffff)));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 16));
+        return _mm256_mul_ps(_mm256_sub_ps(a, b), _mm256_set1_ps(1.0f/65536));
+    }
+
+
+    __attribute__((target("avx2")))
+    static inline __m256i
+    quantize_avx2(const float * p, __m256 scale, __m256 lo, __m256 hi, __m256i * state)
+    {
+        __m256 x = _mm256_loadu_ps(p);
+        __m256 y = _mm256_mul_ps(_mm256_and_ps(x, _mm256_cmp_ps(x, x, _CMP_ORD_Q)), scale);
+        if(state)
+            y = _mm256_add_ps(y, dither_avx2(*state));
+        y = _mm256_min_ps(_mm256_max_ps(y, lo), hi);
+        return _mm256_cvtps_epi32(y);
+    }
+
+
+    __attribute__((target("avx2")))
+    static size_t
+    encode_avx2(const float * in, unsigned char * out, size_t n, pcm_format format, uint32_t * state)
+    {
+        pcm_limits l = limits(format);
+        const __m256 scale = _mm256_set1_ps(l.scale);
+        const __m256 lo = _mm256_set1_ps(l.lo);
+        const __m256 hi = _mm256_set1_ps(l.hi);
+        const __m256i pack24 = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+        __m256i s = state ? _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state)) : _mm256_setzero_si256();
+
+        __m256i * d = state ? &s : nullptr;
+
+        size_t i = 0;
+        if(format == pcm_format::s16)
+            for(; i+16 <= n; i+=16)
+            {
+                __m256i a = quantize_avx2(in+i, scale, lo, hi, d);
+                __m256i b = quantize_avx2(in+i+8, scale, lo, hi, d);
+                __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8); // the pack interleaves the lanes
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out+2*i), v);
+            }
+        else if(format == pcm_format::s24)
+            for(; i+10 <= n; i+=8) // writes 28 bytes and uses 24
+            {
+                __m256i v = _mm256_shuffle_epi8(quantize_avx2(in+i, scale, lo, hi, d), pack24);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out+3*i), _mm256_castsi256_si128(v));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out+3*i+12), _mm256_extracti128_si256(v, 1));
+            }
+        else
+            for(; i+8 <= n; i+=8)
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out+4*i), quantize_avx2(in+i, scale, lo, hi, d));
+
+        if(state)
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(state), s);
+        _mm256_zeroupper();
+        return i;
+    }
+
+
+    __attribute__((target("avx2")))
+    static size_t
+    decode_avx2(const unsigned char * in, float * out, size_t n, pcm_format format)
+    {
+        const __m256i unpack24 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11));
+        size_t i = 0;
+        if(format == pcm_format::s16)
+            for(; i+8 <= n; i+=8)
+            {
+                __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in+2*i)));
+                _mm256_storeu_ps(out+i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f/32768)));
+            }
+        else if(format == pcm_format::s24)
+            for(; i+10 <= n; i+=8) // reads 28 bytes and uses 24
+            {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+3*i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+3*i+12));
+                __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+                v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, unpack24), 8);
+                _mm256_storeu_ps(out+i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f/8388608)));
+            }
+        else
+            for(; i+8 <= n; i+=8)
+            {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in+4*i));
+                _mm256_storeu_ps(out+i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f/2147483648.0f)));
+            }
+        _mm256_zeroupper();
+        return i;
+    }
+
+#endif
+
+    // Kernel selection
+
+    typedef size_t (*encode_kernel)(const float *, unsigned char *, size_t, pcm_format, uint32_t *);
+    typedef size_t (*decode_kernel)(const unsigned char *, float *, size_t, pcm_format);
+
+    static size_t encode_none(const float *, unsigned char *, size_t, pcm_format, uint32_t *) { return 0; }
+    static size_t decode_none(const unsigned char *, float *, size_t, pcm_format) { return 0; }
+
+    struct pcm_kernels
+    {
+        encode_kernel encode;
+        decode_kernel decode;
+        pcm_kernels();
+    };
+
+    static void
+    assign(pcm_kernels & k, pcm_isa isa)
+    {
+        k.encode = encode_none;
+        k.decode = decode_none;
+        #ifdef PCM_X86
+        if(isa == pcm_isa::avx2)
+        {
+            k.encode = encode_avx2;
+            k.decode = decode_avx2;
+        }
+        else if(isa == pcm_isa::sse41)
+        {
+            k.encode = encode_sse41;
+            k.decode = decode_sse41;
+        }
+        #endif
+    }
+
+    pcm_kernels::pcm_kernels()
+    {
+        assign(*this, pcm_best_isa());
+    }
+
+    static pcm_kernels & selected()
+    {
+        static pcm_kernels k;
+        return k;
+    }
+
+
+    pcm_isa
+    pcm_best_isa()
+    {
+        #ifdef PCM_X86
+        if(__builtin_cpu_supports("avx2"))
+            return pcm_isa::avx2;
+        if(__builtin_cpu_supports("sse4.1"))
+            return pcm_isa::sse41;
+        #endif
+        return pcm_isa::scalar;
+    }
+
+
+    void
+    pcm_set_isa(pcm_isa isa)
+    {
+        assign(selected(), isa);
+    }
+
+    // Conversion
+
+    void
+    pcm_encode(const float * in, void * out, size_t n, pcm_format format, pcm_dither * dither)
+    {
+        uint32_t * state = dither && format != pcm_format::s32 ? dither->state : nullptr;
+        unsigned char * o = static_cast<unsigned char *>(out);
+        size_t i = selected().encode(in, o, n, format, state);
+        encode_scalar(in+i, o+i*pcm_bytes(format), n-i, format, state);
+    }
+
+
+    void
+    pcm_decode(const void * in, float * out, size_t n, pcm_format format)
+    {
+        const unsigned char * p = static_cast<const unsigned char *>(in);
+        size_t i = selected().decode(p, out, n, format);
+        decode_scalar(p+i*pcm_bytes(format), out+i, n-i, format);
+    }
+
+
+    std::vector<unsigned char>
+    pcm_encode(matrix & m, pcm_format format, pcm_dither * dither)
+    {
+        size_t n = m.element_count();
+        std::vector<unsigned char> data(n*pcm_bytes(format));
+        if(n == 0)
+            return data;
+        if(m.contiguous())
+            pcm_encode(std::as_const(m).data(), data.data(), n, format, dither);
+        else
+        {
+            matrix packed; // without the gaps of a submatrix
+            packed.copy(m);
+            pcm_encode(std::as_const(packed).data(), data.data(), n, format, dither);
+        }
+        return data;
+    }
+
+
+    matrix
+    pcm_decode(const std::vector<unsigned char> & data, pcm_format format)
+    {
+        if(data.size() % pcm_bytes(format) != 0)
+            throw exception("PCM data is not a whole number of samples.");
+        matrix m(int(data.size()/pcm_bytes(format)));
+        pcm_decode(data.data(), m.data(), m.size(), format);
+        return m;
+    }
+};
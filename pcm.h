@@ -0,0 +1,49 @@
+// pcm.h - conversion between float samples and integer PCM with dither and clipping (c) Christian Balkenius 2024
+//
+// Samples in [-1, 1) map to the full range of the integer format; values outside are clamped and NaN is
+// encoded as zero. s24 is packed in three bytes; all formats are little endian. Encoding to s16 and s24 can
+// add triangular (TPDF) dither of one least significant bit, which decorrelates the rounding error from
+// the signal. A float has only 24 bits of precision, so s32 is never dithered.
+//
+//      ikaros::pcm_dither dither;
+//      ikaros::pcm_encode(samples, buffer, n, ikaros::pcm_format::s16, &dither);
+//
+// The kernels neither allocate nor lock and can be used in an audio callback. The dither keeps eight
+// independent generators, and sample i of a call uses generator i % 8, so the output for a given seed is
+// the same for every kernel.
+
+#ifndef PCM
+#define PCM
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "matrix.h"
+
+namespace ikaros
+{
+    enum class pcm_format { s16, s24, s32 };
+
+    inline int pcm_bytes(pcm_format format) { return format == pcm_format::s16 ? 2 : format == pcm_format::s24 ? 3 : 4; } // per sample
+
+    struct pcm_dither
+    {
+        uint32_t    state[8];
+
+        pcm_dither(uint64_t seed=1);
+    };
+
+    void pcm_encode(const float * in, void * out, size_t n, pcm_format format, pcm_dither * dither=nullptr); // writes n*pcm_bytes(format) bytes; no dither if dither is nullptr
+    void pcm_decode(const void * in, float * out, size_t n, pcm_format format);
+
+    std::vector<unsigned char> pcm_encode(matrix & m, pcm_format format, pcm_dither * dither=nullptr); // all elements in row major order
+    matrix pcm_decode(const std::vector<unsigned char> & data, pcm_format format);                      // one-dimensional
+
+    enum class pcm_isa { scalar, sse41, avx2 };
+
+    pcm_isa pcm_best_isa();             // fastest kernel supported by this processor
+    void pcm_set_isa(pcm_isa isa);      // select kernel; the default is pcm_best_isa()
+};
+
+#endif
@@ -0,0 +1,138 @@
+// philox.h - counter based random numbers (c) Christian Balkenius 2024
+//
+// Philox4x32-10 from Salmon et al. "Parallel random numbers: as easy as 1, 2, 3" (SC 2011).
+// Each value is a pure function of (seed, stream, index), so any range of a random sequence can be
+// regenerated on its own, in any order and on any thread. The state is the 8 byte seed.
+
+#ifndef PHILOX
+#define PHILOX
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace ikaros
+{
+    class philox
+    {
+    public:
+        using result_type = uint32_t;
+
+        philox(uint64_t seed=0) : key_(seed) {}
+
+        void seed(uint64_t seed) { key_ = seed; counter_ = 0; }
+        uint64_t get_seed() const { return key_; }
+
+        std::array<uint32_t, 4>
+        block(uint64_t counter, uint64_t stream=0) const // four random words for one counter value
+        {
+            uint32_t c[4] = {uint32_t(counter), uint32_t(counter >> 32), uint32_t(stream), uint32_t(stream >> 32)};
+            uint32_t k0 = uint32_t(key_);
+            uint32_t k1 = uint32_t(key_ >> 32);
+            for(int r=0; r<rounds; r++)
+            {
+                round(c[0], c[1], c[2], c[3], k0, k1);
+                k0 += w0;
+                k1 += w1;
+            }
+            return {c[0], c[1], c[2], c[3]};
+        }
+
+        uint32_t
+        bits(uint64_t index, uint64_t stream=0) const // random word number index in a stream
+        {
+            return block(index/4, stream)[index%4];
+        }
+
+        static float
+        to_float(uint32_t x) // uniform in [0, 1) using the top 24 bits
+        {
+            return float(x >> 8) * (1.0f/16777216.0f);
+        }
+
+        float
+        uniform(uint64_t index, uint64_t stream=0) const // uniform in [0, 1) for position index in a stream; same as fill_uniform
+        {
+            return to_float(bits(index, stream));
+        }
+
+        void
+        fill_uniform(float * out, size_t n, uint64_t first=0, uint64_t stream=0) const // out[i] = uniform(first+i, stream)
+        {
+            while(n > 0 && first % 4 != 0) // align to a block
+            {
+                *out++ = uniform(first++, stream);
+                n--;
+            }
+
+            const int lanes = 16; // blocks computed side by side so that the compiler can vectorize the rounds
+            uint32_t c0[lanes], c1[lanes], c2[lanes], c3[lanes];
+            while(n >= 4*lanes)
+            {
+                uint64_t counter = first/4;
+                for(int j=0; j<lanes; j++)
+                {
+                    c0[j] = uint32_t(counter+j);
+                    c1[j] = uint32_t((counter+j) >> 32);
+                    c2[j] = uint32_t(stream);
+                    c3[j] = uint32_t(stream >> 32);
+                }
+                uint32_t k0 = uint32_t(key_);
+                uint32_t k1 = uint32_t(key_ >> 32);
+                for(int r=0; r<rounds; r++)
+                {
+                    for(int j=0; j<lanes; j++)
+                        round(c0[j], c1[j], c2[j], c3[j], k0, k1);
+                    k0 += w0;
+                    k1 += w1;
+                }
+                for(int j=0; j<lanes; j++)
+                {
+                    out[4*j+0] = to_float(c0[j]);
+                    out[4*j+1] = to_float(c1[j]);
+                    out[4*j+2] = to_float(c2[j]);
+                    out[4*j+3] = to_float(c3[j]);
+                }
+                out += 4*lanes;
+                first += 4*lanes;
+                n -= 4*lanes;
+            }
+
+            while(n-- > 0)
+                *out++ = uniform(first++, stream);
+        }
+
+        // Sequential use as a UniformRandomBitGenerator, e.g. with std::uniform_real_distribution; uses stream 0
+
+        static constexpr uint32_t min() { return 0; }
+        static constexpr uint32_t max() { return std::numeric_limits<uint32_t>::max(); }
+        uint32_t operator()() { return bits(counter_++); }
+        void discard(uint64_t n) { counter_ += n; }
+
+    private:
+        static const int rounds = 10;
+        static const uint32_t m0 = 0xD2511F53;
+        static const uint32_t m1 = 0xCD9E8D57;
+        static const uint32_t w0 = 0x9E3779B9;
+        static const uint32_t w1 = 0xBB67AE85;
+
+        static void
+        round(uint32_t & c0, uint32_t & c1, uint32_t & c2, uint32_t & c3, uint32_t k0, uint32_t k1)
+        {
+            uint64_t p0 = uint64_t(m0) * c0;
+            uint64_t p1 = uint64_t(m1) * c2;
+            uint32_t n0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+            uint32_t n2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+            c1 = uint32_t(p1);
+            c3 = uint32_t(p0);
+            c0 = n0;
+            c2 = n2;
+        }
+
+        uint64_t key_;
+        uint64_t counter_ = 0;
+    };
+};
+
+#endif
@@ -1,81 +1,184 @@
+#include "control.h"
+#include "envelope.h"
 #include "matrix.h"
+#include "philox.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <random>
 #include <vector>
 
-class R2D2Synth {
+// The random generator is pluggable. RNG must be counter based: constructible and seedable from a
+// uint64_t, with uniform(index, stream) and fill_uniform(out, n, first, stream) giving floats in [0, 1)
+// that depend only on the seed, the stream and the index (see philox.h).
+//
+// Every generate call uses streams of its own, numbered by a render counter that starts at zero
+// when the synth is seeded. A given seed therefore gives the same sequence of sounds, and any
+// sample range of a render can be regenerated on its own.
+//
+// Each sample is computed from its index alone, so a render can be split into time chunks that run
+// on the shared thread pool. The result is identical to the serial render.
+//
+// Slow modulators such as chirp frequencies are evaluated at control rate, every
+// ikaros::control_period samples, and interpolated; only the oscillators run at audio rate.
+// A fast modulator such as the 50 Hz vibrato of generateSurprisedSound runs at audio rate in
+// double precision: the tone multiplies its error by the time since the start, so an interpolated
+// or single precision vibrato drifts audibly over a long sound.
+//
+// The tones are sin(2 pi f(t) t), so their instantaneous frequency is f + t f', which grows with
+// the time since the sound started and can pass the Nyquist frequency, where it aliases. With
+// setBandLimited each partial fades out before it reaches the Nyquist frequency and is not computed
+// above it. The sounds can then be rendered at 16 or 22 kHz directly. The envelopes, the noise and
+// the random amplitude of the laughter add no partials that could alias, so nothing needs oversampling.
+
+template <typename RNG = ikaros::philox>
+class BasicR2D2Synth {
 private:
+    enum { parameterStream, noiseStream, amplitudeStream, numStreams };
+
     const int sampleRate;
-    std::mt19937 rng;
-    std::uniform_real_distribution<float> uniformDist;
+    RNG rng;
+    uint64_t renderCount = 0;
+    int parallelGrain = 0;
+    bool bandLimited = false;
 
-    float generateChirp(float t, float baseFreq, float freqRange, float chirpRate) {
-        float freq = baseFreq + freqRange * std::sin(chirpRate * t);
-        return std::sin(2 * M_PI * freq * t);
+    uint64_t beginRender() {
+        return numStreams * renderCount++;
     }
 
-    float applyEnvelope(float t, float duration, float attackTime, float releaseTime) {
-        if (t < attackTime) {
-            return t / attackTime;
-        } else if (t > duration - releaseTime) {
-            return (duration - t) / releaseTime;
-        }
-        return 1.0f;
+    float random(uint64_t render, int stream, uint64_t index) const {
+        return rng.uniform(index, render + stream);
+    }
+
+    template <typename F>
+    void renderSamples(ikaros::matrix & sound, F && f) { // calls f(out, a, b) for consecutive ranges [a, b) of the samples
+        int numSamples = sound.size();
+        if (numSamples == 0)
+            return;
+        float * out = sound.data();
+        auto chunk = [&](int a, int b) { TRACE_SCOPE("R2D2Synth::renderSamples"); f(out, a, b); };
+        if (parallelGrain > 0 && numSamples > parallelGrain)
+            ikaros::thread_pool::instance().parallel_for(0, numSamples, parallelGrain, chunk);
+        else
+            chunk(0, numSamples);
+    }
+
+    float time(int i) const {
+        return static_cast<float>(i) / sampleRate;
+    }
+
+    float chirpFrequency(float t, float baseFreq, float freqRange, float chirpRate) {
+        return baseFreq + freqRange * std::sin(chirpRate * t);
+    }
+
+    float instantaneous(double t, double freq, double slope) const { // frequency of sin(2 pi freq t) when freq changes by slope per sample
+        return freq + t * slope * sampleRate;
     }
 
-    float generateNoise(float amplitude) {
-        return amplitude * (uniformDist(rng) * 2 - 1);
+    float generateTone(double t, double freq, float instFreq, int harmonic = 1) const { // sin(2 pi harmonic freq t), faded out near the Nyquist frequency when band limited
+        float gain = bandLimited ? ikaros::band_limit(harmonic * instFreq, sampleRate) : 1;
+        if (gain == 0)
+            return 0;
+        float tone = std::sin(2 * harmonic * M_PI * freq * t);
+        return gain * tone;
     }
 
-    float generateLaughPulse(float t, float baseFreq, float freqRange, float pulseRate) {
-        float freq = baseFreq + freqRange * std::sin(2 * M_PI * pulseRate * t);
-        return std::sin(2 * M_PI * freq * t);
+    // Linear attack and release over the samples [first, last). This runs after the parallel
+    // part of a render so that its result does not depend on how the samples were split.
+
+    void applyEnvelope(ikaros::matrix & sound, int first, int last, float attackTime, float releaseTime) {
+        if (first >= last)
+            return;
+        ikaros::envelope envelope(sampleRate);
+        envelope.set(attackTime, 0, 1, releaseTime);
+        envelope.note_on(std::max(0L, last - first - std::lround(releaseTime * sampleRate)));
+        envelope.apply(sound.data() + first, last - first);
+    }
+
+    float generateNoise(float amplitude, float uniform) {
+        return amplitude * (uniform * 2 - 1);
+    }
+
+    float laughFrequency(float t, float baseFreq, float freqRange, float pulseRate) {
+        return baseFreq + freqRange * std::sin(2 * M_PI * pulseRate * t);
     }
 
 public:
-    R2D2Synth(int sampleRate = 44100) : sampleRate(sampleRate), 
-                                        rng(std::random_device{}()),
-                                        uniformDist(0.0f, 1.0f) {}
+    BasicR2D2Synth(int sampleRate = 44100) : sampleRate(sampleRate),
+                                             rng(uint64_t(std::random_device{}()) << 32 | std::random_device{}()) {}
+
+    BasicR2D2Synth(int sampleRate, uint64_t seed) : sampleRate(sampleRate), rng(seed) {}
+
+    void seed(uint64_t seed, uint64_t render = 0) { // render selects which sound the next generate call repeats
+        rng.seed(seed);
+        renderCount = render;
+    }
+
+    uint64_t renders() const { return renderCount; }
+
+    void setParallel(int grain = 16384) { // render in chunks of at least grain samples on the thread pool; 0 renders serially
+        parallelGrain = grain;
+    }
+
+    void setBandLimited(bool on = true) { // fade out partials that would alias
+        bandLimited = on;
+    }
 
     ikaros::matrix generateSound(float duration) {
+        TRACE_SCOPE("R2D2Synth::generateSound");
         int numSamples = static_cast<int>(duration * sampleRate);
         ikaros::matrix sound(numSamples);
 
-        float baseFreq = 1000 + uniformDist(rng) * 1000;
-        float freqRange = 500 + uniformDist(rng) * 500;
-        float chirpRate = 10 + uniformDist(rng) * 20;
+        uint64_t render = beginRender();
+        float baseFreq = 1000 + random(render, parameterStream, 0) * 1000;
+        float freqRange = 500 + random(render, parameterStream, 1) * 500;
+        float chirpRate = 10 + random(render, parameterStream, 2) * 20;
 
-        for (int i = 0; i < numSamples; ++i) {
-            float t = static_cast<float>(i) / sampleRate;
-            float sample = generateChirp(t, baseFreq, freqRange, chirpRate);
-            float envelope = applyEnvelope(t, duration, 0.1f, 0.1f);
-            sound(i) = 0.5f * envelope * sample;
-        }
+        renderSamples(sound, [&](float * out, int a, int b) {
+            ikaros::control_rate(a, b, [&](int j) {
+                return chirpFrequency(time(j), baseFreq, freqRange, chirpRate);
+            }, [&](int i, float freq, float slope) {
+                float t = time(i);
+                out[i] = 0.5f * generateTone(t, freq, instantaneous(t, freq, slope));
+            });
+        });
+
+        applyEnvelope(sound, 0, numSamples, 0.1f, 0.1f);
 
         return sound;
     }
 
     ikaros::matrix generateHappySound(float duration) {
+        TRACE_SCOPE("R2D2Synth::generateHappySound");
         int numSamples = static_cast<int>(duration * sampleRate);
         ikaros::matrix sound(numSamples);
 
-        std::vector<float> baseFreqs = {1500, 2000, 2500};
-        float chirpRate = 30 + uniformDist(rng) * 20;
+        static constexpr float baseFreqs[] = {1500, 2000, 2500};
+        uint64_t render = beginRender();
+        float chirpRate = 30 + random(render, parameterStream, 0) * 20;
+
+        renderSamples(sound, [&](float * out, int a, int b) {
+            ikaros::control_rate(a, b, [&](int j) {
+                return chirpFrequency(time(j), 0, 200, chirpRate); // shared by all partials
+            }, [&](int i, float sweep, float slope) {
+                float t = time(i);
+                float sample = 0;
+                for (float baseFreq : baseFreqs) {
+                    sample += generateTone(t, baseFreq + sweep, instantaneous(t, baseFreq + sweep, slope));
+                }
+                out[i] = 0.3f * sample / std::size(baseFreqs);
+            });
+        });
 
-        for (int i = 0; i < numSamples; ++i) {
-            float t = static_cast<float>(i) / sampleRate;
-            float sample = 0;
-            for (float baseFreq : baseFreqs) {
-                sample += generateChirp(t, baseFreq, 200, chirpRate);
-            }
-            float envelope = applyEnvelope(t, duration, 0.05f, 0.1f);
-            sound(i) = 0.3f * envelope * sample / baseFreqs.size();
-        }
+        applyEnvelope(sound, 0, numSamples, 0.05f, 0.1f);
 
         return sound;
     }
 
     ikaros::matrix generateSurprisedSound(float duration) {
+        TRACE_SCOPE("R2D2Synth::generateSurprisedSound");
         int numSamples = static_cast<int>(duration * sampleRate);
         ikaros::matrix sound(numSamples);
 
@@ -84,20 +187,23 @@ public:
         float vibratoRate = 50;
         float vibratoDepth = 100;
 
-        for (int i = 0; i < numSamples; ++i) {
-            float t = static_cast<float>(i) / sampleRate;
-            float instantFreq = startFreq + (endFreq - startFreq) * t / duration;
-            instantFreq += vibratoDepth * std::sin(2 * M_PI * vibratoRate * t);
-            float phase = 2 * M_PI * instantFreq * t;
-            float sample = std::sin(phase);
-            float envelope = applyEnvelope(t, duration, 0.01f, 0.05f);
-            sound(i) = 0.5f * envelope * sample;
-        }
+        renderSamples(sound, [&](float * out, int a, int b) {
+            for (int i = a; i < b; i++) {
+                double t = static_cast<double>(i) / sampleRate;
+                double vibrato = 2 * M_PI * vibratoRate * t;
+                double instantFreq = startFreq + (endFreq - startFreq) * t / duration + vibratoDepth * std::sin(vibrato);
+                double slope = bandLimited ? ((endFreq - startFreq) / duration + vibratoDepth * 2 * M_PI * vibratoRate * std::cos(vibrato)) / sampleRate : 0;
+                out[i] = 0.5f * generateTone(t, instantFreq, instantaneous(t, instantFreq, slope));
+            }
+        });
+
+        applyEnvelope(sound, 0, numSamples, 0.01f, 0.05f);
 
         return sound;
     }
 
     ikaros::matrix generateWowSound(float duration) {
+        TRACE_SCOPE("R2D2Synth::generateWowSound");
         int numSamples = static_cast<int>(duration * sampleRate);
         ikaros::matrix sound(numSamples);
 
@@ -105,29 +211,33 @@ public:
         float endFreq = 1000;
         float wowRate = 0.75f; // Controls the speed of the "wow" effect
 
-        for (int i = 0; i < numSamples; ++i) {
-            float t = static_cast<float>(i) / sampleRate;
-            
-            // Create a slow, sweeping frequency modulation
-            float modulation = 0.5f * (1 - std::cos(2 * M_PI * wowRate * t / duration));
-            float instantFreq = startFreq + (endFreq - startFreq) * modulation;
-
-            // Generate the primary tone
-            float sample = std::sin(2 * M_PI * instantFreq * t);
-            
-            // Add harmonics for richness
-            sample += 0.5f * std::sin(4 * M_PI * instantFreq * t);
-            sample += 0.25f * std::sin(6 * M_PI * instantFreq * t);
-
-            // Apply envelope
-            float envelope = applyEnvelope(t, duration, 0.1f, 0.2f);
-            
-            sound(i) = 0.3f * envelope * sample;
-        }
+        renderSamples(sound, [&](float * out, int a, int b) {
+            ikaros::control_rate(a, b, [&](int j) {
+                // Create a slow, sweeping frequency modulation
+                float modulation = 0.5f * (1 - std::cos(2 * M_PI * wowRate * time(j) / duration));
+                return startFreq + (endFreq - startFreq) * modulation;
+            }, [&](int i, float instantFreq, float slope) {
+                float t = time(i);
+                float f = instantaneous(t, instantFreq, slope);
+
+                // Generate the primary tone
+                float sample = generateTone(t, instantFreq, f);
+
+                // Add harmonics for richness
+                sample += 0.5f * generateTone(t, instantFreq, f, 2);
+                sample += 0.25f * generateTone(t, instantFreq, f, 3);
+
+                out[i] = 0.3f * sample;
+            });
+        });
+
+        applyEnvelope(sound, 0, numSamples, 0.1f, 0.2f);
 
         return sound;
     }
+
     ikaros::matrix generateProtestSound(float duration) {
+        TRACE_SCOPE("R2D2Synth::generateProtestSound");
         int numSamples = static_cast<int>(duration * sampleRate);
         ikaros::matrix sound(numSamples);
 
@@ -137,22 +247,31 @@ public:
         int numChirps = 5;
         float chirpDuration = duration / numChirps;
 
+        renderSamples(sound, [&](float * out, int a, int b) {
+            for (int chirp = 0; chirp < numChirps; chirp++) {
+                int startSample = chirp * chirpDuration * sampleRate;
+                int endSample = std::min((chirp + 1) * chirpDuration * sampleRate, (float)numSamples);
+
+                ikaros::control_rate(std::max(startSample, a), std::min(endSample, b), [&](int j) {
+                    return chirpFrequency(time(j - startSample), baseFreq, freqRange, chirpRate);
+                }, [&](int i, float freq, float slope) {
+                    float t = time(i - startSample);
+                    out[i] = 0.5f * generateTone(t, freq, instantaneous(t, freq, slope));
+                });
+            }
+        });
+
         for (int chirp = 0; chirp < numChirps; chirp++) {
             int startSample = chirp * chirpDuration * sampleRate;
             int endSample = std::min((chirp + 1) * chirpDuration * sampleRate, (float)numSamples);
-
-            for (int i = startSample; i < endSample; i++) {
-                float t = static_cast<float>(i - startSample) / sampleRate;
-                float sample = generateChirp(t, baseFreq, freqRange, chirpRate);
-                float envelope = applyEnvelope(t, chirpDuration, 0.01f, 0.05f);
-                sound(i) = 0.5f * envelope * sample;
-            }
+            applyEnvelope(sound, startSample, endSample, 0.01f, 0.05f);
         }
 
         return sound;
     }
 
     ikaros::matrix generateIndignationSound(float duration) {
+        TRACE_SCOPE("R2D2Synth::generateIndignationSound");
         int numSamples = static_cast<int>(duration * sampleRate);
         ikaros::matrix sound(numSamples);
 
@@ -161,21 +280,31 @@ public:
         float chirpRate = 30;
         float noiseFactor = 0.2f;
 
-        for (int i = 0; i < numSamples; i++) {
-            float t = static_cast<float>(i) / sampleRate;
-            float modulation = std::pow(std::sin(2 * M_PI * 2 * t / duration), 2);
-            float instantFreq = baseFreq + freqRange * modulation;
-            float sample = std::sin(2 * M_PI * instantFreq * t);
-            sample += 0.5f * std::sin(4 * M_PI * instantFreq * t);
-            sample += generateNoise(noiseFactor);
-            float envelope = applyEnvelope(t, duration, 0.05f, 0.1f);
-            sound(i) = 0.4f * envelope * sample;
-        }
+        uint64_t render = beginRender();
+
+        renderSamples(sound, [&](float * out, int a, int b) {
+            rng.fill_uniform(out + a, b - a, a, render + noiseStream); // replaced by the sound below
+
+            ikaros::control_rate(a, b, [&](int j) {
+                float modulation = std::sin(2 * M_PI * 2 * time(j) / duration);
+                return baseFreq + freqRange * modulation * modulation;
+            }, [&](int i, float instantFreq, float slope) {
+                float t = time(i);
+                float f = instantaneous(t, instantFreq, slope);
+                float sample = generateTone(t, instantFreq, f);
+                sample += 0.5f * generateTone(t, instantFreq, f, 2);
+                sample += generateNoise(noiseFactor, out[i]);
+                out[i] = 0.4f * sample;
+            });
+        });
+
+        applyEnvelope(sound, 0, numSamples, 0.05f, 0.1f);
 
         return sound;
     }
 
     ikaros::matrix generateLaughterSound(float duration, float intensity) {
+        TRACE_SCOPE("R2D2Synth::generateLaughterSound");
         intensity = std::clamp(intensity, 0.1f, 1.0f);
         int numSamples = static_cast<int>(duration * sampleRate);
         ikaros::matrix sound(numSamples);
@@ -188,25 +317,132 @@ public:
         float pulseDuration = duration / numPulses;
         float pulseSpacing = pulseDuration * 0.2f;  // 20% of pulse duration for spacing
 
+        // Pulse p covers the samples [firsts[p], lasts[p]); pulses start in increasing order and do not overlap
+
+        std::array<int, 12> firsts, lasts; // at most 12 pulses at full intensity
+        int first = 0;
         for (int pulse = 0; pulse < numPulses; pulse++) {
             float pulseStart = pulse * pulseDuration;
             float pulseEnd = pulseStart + pulseDuration - pulseSpacing;
+            while (first < numSamples && static_cast<float>(first) / sampleRate < pulseStart)
+                first++;
+            int last = first;
+            while (last < numSamples && static_cast<float>(last) / sampleRate < pulseEnd)
+                last++;
+            firsts[pulse] = first;
+            lasts[pulse] = last;
+        }
+
+        uint64_t render = beginRender();
+
+        renderSamples(sound, [&](float * out, int a, int b) {
+            for (int pulse = 0; pulse < numPulses; pulse++) {
+                float pulseStart = pulse * pulseDuration;
+                int first = std::max(firsts[pulse], a);
+                int last = std::min(lasts[pulse], b);
+                if (first >= last)
+                    continue;
+
+                // Random index pulse * numSamples + i, so that each pulse has its own values; they are replaced by the sound below
+                rng.fill_uniform(out + first, last - first, uint64_t(pulse) * numSamples + first, render + amplitudeStream);
+
+                ikaros::control_rate(first, last, [&](int j) {
+                    return laughFrequency(time(j) - pulseStart, baseFreq, freqRange, pulseRate);
+                }, [&](int i, float freq, float slope) {
+                    float pulseT = time(i) - pulseStart;
+                    float sample = generateTone(pulseT, freq, instantaneous(pulseT, freq, slope));
 
-            for (int i = 0; i < numSamples; i++) {
-                float t = static_cast<float>(i) / sampleRate;
-                if (t >= pulseStart && t < pulseEnd) {
-                    float pulseT = t - pulseStart;
-                    float sample = generateLaughPulse(pulseT, baseFreq, freqRange, pulseRate);
-                    float envelope = applyEnvelope(pulseT, pulseDuration - pulseSpacing, 0.01f, 0.05f);
-                    
                     // Add some randomness to the amplitude for a more natural sound
-                    float randomFactor = 1.0f + 0.2f * (uniformDist(rng) - 0.5f);
-                    
-                    sound(i) += 0.5f * envelope * sample * randomFactor * intensity;
-                }
+                    float randomFactor = 1.0f + 0.2f * (out[i] - 0.5f);
+
+                    out[i] = 0.5f * sample * randomFactor * intensity;
+                });
             }
+        });
+
+        for (int pulse = 0; pulse < numPulses; pulse++) {
+            applyEnvelope(sound, firsts[pulse], lasts[pulse], 0.01f, 0.05f);
         }
 
         return sound;
     }
-};
\ No newline at end of file
+};
+
+using R2D2Synth = BasicR2D2Synth<>;
+
+// A chirp voice that plays until note off while its parameters are changed from other threads.
+// The parameters are read once per control period and smoothed. The tone uses a phase accumulator,
+// so the voice can play for any length of time.
+
+class R2D2Voice {
+public:
+    ikaros::parameter baseFreq{1500};
+    ikaros::parameter freqRange{500};
+    ikaros::parameter chirpRate{20};    // radians per second, as in R2D2Synth
+    ikaros::parameter gain{0.5f};
+
+    R2D2Voice(int sampleRate = 44100) : sampleRate(sampleRate), adsr(sampleRate) {
+        adsr.set(0.01f, 0.05f, 0.8f, 0.1f);
+    }
+
+    ikaros::envelope & envelope() { return adsr; }
+
+    void noteOn() { // starts at the current parameter values without smoothing
+        for (ikaros::parameter * p : {&baseFreq, &freqRange, &chirpRate, &gain})
+            p->jump();
+        position = 0;
+        phase = 0;
+        chirpPhase = 0;
+        freqEnd = baseFreq.end();
+        adsr.note_on();
+    }
+
+    void noteOff() {
+        adsr.note_off();
+    }
+
+    bool active() const {
+        return adsr.active();
+    }
+
+    void process(float * out, int n) {
+        if (!active()) {
+            std::fill(out, out + n, 0.0f);
+            return;
+        }
+        float * block = out;
+        for (int remaining = n; remaining > 0;) {
+            int offset = position % ikaros::control_period;
+            if (offset == 0)
+                tick();
+            int span = std::min(remaining, ikaros::control_period - offset);
+            for (int i = 0; i < span; i++) {
+                float x = float(offset + i) / ikaros::control_period;
+                phase += (freqStart + (freqEnd - freqStart) * x) / sampleRate;
+                phase -= std::floor(phase);
+                block[i] = gain.at(offset + i) * std::sin(2 * M_PI * phase);
+            }
+            block += span;
+            remaining -= span;
+            position += span;
+        }
+        adsr.apply(out, n);
+    }
+
+private:
+    const int sampleRate;
+    ikaros::envelope adsr;
+    int64_t position = 0;
+    double phase = 0;           // cycles
+    double chirpPhase = 0;      // radians
+    float freqStart = 0;
+    float freqEnd = 0;
+
+    void tick() { // start a control period
+        for (ikaros::parameter * p : {&baseFreq, &freqRange, &chirpRate, &gain})
+            p->tick();
+        chirpPhase += chirpRate.end() * ikaros::control_period / sampleRate;
+        freqStart = freqEnd;
+        freqEnd = baseFreq.end() + freqRange.end() * std::sin(chirpPhase);
+    }
+};
@@ -1,5 +1,6 @@
 // range.cc   (c) Christian Balkenius 2023
 
+#include <charconv>
 #include <iostream>
 
 #include "range.h"
@@ -57,6 +58,19 @@ namespace ikaros
         return b_;
     }
 
+    static int
+    range_value(std::string_view s) // parse an integer in a range string
+    {
+        if(!s.empty() && s[0] == '+')
+            s.remove_prefix(1);
+        int value = 0;
+        auto [end, ec] = std::from_chars(s.data(), s.data()+s.size(), value);
+        if(ec != std::errc() || end == s.data())
+            throw std::invalid_argument("Malformed range string");
+        return value;
+    }
+
+
     range::range(std::string s)
     {
         if(s.empty())
@@ -66,36 +80,40 @@ namespace ikaros
         if(s[s.size()-1] != ']')
             throw std::invalid_argument("Malformed range string");
 
-        std::vector<std::string> ranges = split(s.substr(1, s.size()-2), "][");
-
-        for(auto & ss : ranges)
+        for(std::string_view ss : split_range(std::string_view(s).substr(1, s.size()-2), "]["))
         {
-            auto & r = split(ss, ":");
-            if(r.size()==1)
+            std::string_view r[3];
+            int n = 0;
+            for(std::string_view part : split_range(ss, ":"))
+            {
+                if(n == 3)
+                    throw std::invalid_argument("Malformed range string");
+                r[n++] = part;
+            }
+
+            if(n==1)
             {
                 if(r[0].empty())
                     push(0, 0, 0);
                 else
-                    push(std::stoi(r[0]), std::stoi(r[0])+1, 1); // single index
+                    push(range_value(r[0]), range_value(r[0])+1, 1); // single index
             }
-            else if(r.size()==2)
+            else if(n==2)
             {
-                int a = r[0].empty() ? 0 : std::stoi(r[0]);
-                int b = r[1].empty() ? 0 : std::stoi(r[1]);
+                int a = r[0].empty() ? 0 : range_value(r[0]);
+                int b = r[1].empty() ? 0 : range_value(r[1]);
                 if(a== 0 && b==0)
                     push(0, 0, 0);
                 else
                     push(a, b, 1);
             }
-            else if(r.size()==3)
+            else
             {
-                int a = r[0].empty() ? 0 : std::stoi(r[0]);
-                int b = r[1].empty() ? 0 : std::stoi(r[1]);
-                int i = r[2].empty() ? (a==0 && b==0 ? 0 : 1) : std::stoi(r[2]);
+                int a = r[0].empty() ? 0 : range_value(r[0]);
+                int b = r[1].empty() ? 0 : range_value(r[1]);
+                int i = r[2].empty() ? (a==0 && b==0 ? 0 : 1) : range_value(r[2]);
                 push(a, b, i);
             }
-            else
-               throw std::invalid_argument("Malformed range string");
         }
     }
 
@@ -0,0 +1,240 @@
+// resampler.cc   (c) Christian Balkenius 2024
+//
+// The prototype filter runs at L times the input rate and is centered at L*taps/2, so that output k
+// sits exactly at input time k*M/L after a delay of taps/2 input samples. Each phase is normalized to
+// unity gain at DC. The inner products sum eight interleaved partial sums in the same order in the
+// scalar and the AVX2 kernel, so both give identical results.
+
+#include "resampler.h"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <tuple>
+#include <utility>
+
+#include "exceptions.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLER_X86
+#include <immintrin.h>
+#endif
+
+namespace ikaros
+{
+    static const int chunk_size = 1024;     // input samples appended to the buffer at a time
+    static const double kaiser_beta = 8.6;  // about 90 dB stopband attenuation
+    static const double passband = 0.92;    // cutoff relative to the lower Nyquist frequency
+
+    // Inner products; n is a multiple of 8
+
+    static float
+    dot_scalar(const float * a, const float * b, int n)
+    {
+        float s[8] = {0};
+        for(int i=0; i<n; i+=8)
+            for(int k=0; k<8; k++)
+                s[k] += a[i+k]*b[i+k];
+        return ((s[0]+s[4]) + (s[2]+s[6])) + ((s[1]+s[5]) + (s[3]+s[7]));
+    }
+
+
+#ifdef RESAMPLER_X86
+    __attribute__((target("avx2")))
+    static float
+    dot_avx2(const float * a, const float * b, int n)
+    {
+        __m256 s = _mm256_setzero_ps();
+        for(int i=0; i<n; i+=8)
+            s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i)));
+        __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));   // s0+s4 ...
+        h = _mm_add_ps(h, _mm_movehl_ps(h, h));                                         // (s0+s4)+(s2+s6), (s1+s5)+(s3+s7)
+        h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+        float r = _mm_cvtss_f32(h);
+        _mm256_zeroupper();
+        return r;
+    }
+#endif
+
+    typedef float (*dot_kernel)(const float *, const float *, int);
+
+    static dot_kernel
+    kernel(resampler_isa isa)
+    {
+        #ifdef RESAMPLER_X86
+        if(isa == resampler_isa::avx2)
+            return dot_avx2;
+        #endif
+        return dot_scalar;
+    }
+
+    static dot_kernel & selected()
+    {
+        static dot_kernel k = kernel(resampler_best_isa());
+        return k;
+    }
+
+
+    resampler_isa
+    resampler_best_isa()
+    {
+        #ifdef RESAMPLER_X86
+        if(__builtin_cpu_supports("avx2"))
+            return resampler_isa::avx2;
+        #endif
+        return resampler_isa::scalar;
+    }
+
+
+    void
+    resampler_set_isa(resampler_isa isa)
+    {
+        selected() = kernel(isa);
+    }
+
+    // Filter design
+
+    static double
+    bessel_i0(double x)
+    {
+        double sum = 1, term = 1;
+        for(int k=1; k<50 && term > 1e-12*sum; k++)
+        {
+            term *= (x/(2*k)) * (x/(2*k));
+            sum += term;
+        }
+        return sum;
+    }
+
+
+    static std::shared_ptr<const std::vector<float>>
+    design(int up, int down, int taps)
+    {
+        static std::mutex mutex;
+        static std::map<std::tuple<int, int, int>, std::shared_ptr<const std::vector<float>>> tables;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto & table = tables[{up, down, taps}];
+        if(table)
+            return table;
+
+        int length = up*taps;
+        double center = length/2;
+        double cutoff = 0.5 * passband * std::min(1.0, double(up)/down); // cycles per input sample
+        auto filter = std::make_shared<std::vector<float>>(length);
+        for(int p=0; p<up; p++)
+        {
+            float * phase = filter->data()+p*taps;
+            double sum = 0;
+            for(int j=0; j<taps; j++)
+            {
+                int n = p + j*up;
+                double t = (n-center)/up; // input samples
+                double x = 2*cutoff*t;
+                double sinc = x == 0 ? 1 : std::sin(M_PI*x)/(M_PI*x);
+                double r = (n-center)/center;
+                double window = std::fabs(r) < 1 ? bessel_i0(kaiser_beta*std::sqrt(1-r*r))/bessel_i0(kaiser_beta) : 0;
+                phase[taps-1-j] = float(2*cutoff*sinc*window); // reversed so that the phase is applied to the buffer in order
+                sum += 2*cutoff*sinc*window;
+            }
+            for(int j=0; j<taps; j++)
+                phase[j] = float(phase[j]/sum);
+        }
+        table = filter;
+        return table;
+    }
+
+    // Resampler
+
+    resampler::resampler(int input_rate, int output_rate, int taps)
+    {
+        if(input_rate <= 0 || output_rate <= 0 || taps <= 0)
+            throw exception("Resampler rates and taps must be positive.");
+        int g = std::gcd(input_rate, output_rate);
+        up_ = output_rate/g;
+        down_ = input_rate/g;
+        taps_ = (taps*std::max(1, (down_+up_-1)/up_) + 7) / 8 * 8;
+        filter_ = design(up_, down_, taps_);
+        buffer_.assign(taps_-1+chunk_size, 0);
+        reset();
+    }
+
+
+    void
+    resampler::reset()
+    {
+        std::fill(buffer_.begin(), buffer_.end(), 0.0f);
+        filled_ = taps_-1;      // zeros before the first sample
+        position_ = taps_-1 + taps_/2;
+        phase_ = 0;
+    }
+
+
+    int
+    resampler::process(const float * in, int n, float * out)
+    {
+        dot_kernel dot = selected();
+        const float * filter = filter_->data();
+        int written = 0;
+        while(n > 0)
+        {
+            int m = std::min(n, int(buffer_.size())-filled_);
+            std::memcpy(buffer_.data()+filled_, in, m*sizeof(float));
+            filled_ += m;
+            in += m;
+            n -= m;
+
+            while(position_ < filled_)
+            {
+                out[written++] = dot(filter+phase_*taps_, buffer_.data()+position_-(taps_-1), taps_);
+                phase_ += down_;
+                position_ += phase_ / up_;
+                phase_ %= up_;
+            }
+
+            int shift = std::min(position_-(taps_-1), filled_); // keep the history of the next output
+            std::memmove(buffer_.data(), buffer_.data()+shift, (filled_-shift)*sizeof(float));
+            filled_ -= shift;
+            position_ -= shift;
+        }
+        return written;
+    }
+
+
+    matrix
+    resample(matrix & sound, int input_rate, int output_rate, int taps)
+    {
+        if(sound.rank() != 1 && sound.rank() != 2)
+            throw exception("Only sounds of samples or of frames of channels can be resampled.");
+        matrix packed = sound;
+        if(!sound.contiguous()) // without the gaps of a submatrix
+        {
+            packed = matrix();
+            packed.copy(sound);
+        }
+        const float * in = std::as_const(packed).data();
+        int n = sound.shape()[0];
+        int channels = sound.rank() == 2 ? sound.shape()[1] : 1;
+
+        resampler r(input_rate, output_rate, taps);
+        int length = int((long(n)*r.up() + r.down()-1) / r.down());
+        matrix result = sound.rank() == 2 ? matrix(length, channels) : matrix(length);
+        float * result_data = result.data();
+        std::vector<float> channel(channels > 1 ? n : 0); // one channel of the frames
+        std::vector<float> zeros(r.latency()+1, 0.0f); // drains the filter
+        std::vector<float> out(r.max_output(n)+r.max_output(int(zeros.size())));
+        for(int c=0; c<channels; c++)
+        {
+            for(int i=0; i<channel.size(); i++)
+                channel[i] = in[i*channels+c];
+            r.reset();
+            int written = r.process(channels > 1 ? channel.data() : in, n, out.data());
+            written += r.process(zeros.data(), int(zeros.size()), out.data()+written);
+            for(int i=0; i<std::min(length, written); i++)
+                result_data[i*channels+c] = out[i];
+        }
+        return result;
+    }
+};
@@ -0,0 +1,58 @@
+// resampler.h - streaming polyphase sample rate conversion (c) Christian Balkenius 2024
+//
+// The ratio is reduced to L/M, and the input is conceptually upsampled by L, lowpass filtered and
+// downsampled by M; only the L phases of the filter that are actually needed are computed. The filter is
+// a Kaiser windowed sinc with a cutoff just below the lower of the two Nyquist frequencies, and it is
+// lengthened by the decimation factor when downsampling, so the transition band stays equally narrow.
+// Filter tables are computed once for each ratio and shared by all resamplers with that ratio.
+//
+//      ikaros::resampler r(44100, 16000);
+//      int written = r.process(in, n, out);   // out needs room for r.max_output(n) samples
+//
+// Output sample k is the signal at input time k * input_rate / output_rate; it is produced as soon as
+// the input has reached latency() samples beyond that time. process does not allocate.
+
+#ifndef RESAMPLER
+#define RESAMPLER
+
+#include <memory>
+#include <vector>
+
+#include "matrix.h"
+
+namespace ikaros
+{
+    class resampler
+    {
+    public:
+        resampler(int input_rate, int output_rate, int taps=64); // taps of each phase when not downsampling; rounded up to a multiple of 8
+
+        int process(const float * in, int n, float * out);  // consume n samples; returns the number of samples written
+        int max_output(int n) const { return int((long(n)+1)*up_/down_)+1; }
+        int latency() const { return taps_/2; }              // input samples
+        void reset();
+
+        int up() const { return up_; }
+        int down() const { return down_; }
+        int taps() const { return taps_; }
+
+    private:
+        int                                     up_;        // L
+        int                                     down_;      // M
+        int                                     taps_;
+        std::shared_ptr<const std::vector<float>> filter_;  // up_ phases of taps_ coefficients, each reversed
+        std::vector<float>                      buffer_;    // taps_-1 samples of history followed by new input
+        int                                     filled_;
+        int                                     position_;  // index in buffer_ of the newest input sample of the next output
+        int                                     phase_;
+    };
+
+    matrix resample(matrix & sound, int input_rate, int output_rate, int taps=64); // the whole sound, aligned in time: duration is kept; [samples] or [frames][channels], each channel on its own
+
+    enum class resampler_isa { scalar, avx2 };
+
+    resampler_isa resampler_best_isa();
+    void resampler_set_isa(resampler_isa isa);
+};
+
+#endif
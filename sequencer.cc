@@ -0,0 +1,175 @@
+// sequencer.cc   (c) Christian Balkenius 2024
+
+#include "sequencer.h"
+
+#include <algorithm>
+
+#include "alloc.h"
+#include "trace.h"
+
+namespace ikaros
+{
+    sequencer::sequencer(int threads, int capacity) : mixer_(threads), queue_(capacity), finished_(queue_.capacity())
+    {
+        pending_.reserve(queue_.capacity());
+        mixer_.reserve(queue_.capacity());
+    }
+
+
+    bool
+    sequencer::post(event && e)
+    {
+        return queue_.push(std::move(e));
+    }
+
+
+    long
+    sequencer::trigger(long time, patch && sound, float gain, float duration, uint64_t seed)
+    {
+        reclaim();
+        if(live_.fetch_add(1) >= int(queue_.capacity()))
+        {
+            live_.fetch_sub(1);
+            return -1;
+        }
+        event e;
+        e.type = event::trigger;
+        e.time = time;
+        e.voice = next_voice_.fetch_add(1);
+        e.sound = mixer::make_voice(std::move(sound), gain, duration, seed, e.voice);
+        long voice = e.voice;
+        if(post(std::move(e)))
+            return voice;
+        live_.fetch_sub(1);
+        return -1;
+    }
+
+
+    bool
+    sequencer::set_gain(long time, long voice, float gain)
+    {
+        event e;
+        e.type = event::gain;
+        e.time = time;
+        e.voice = voice;
+        e.value = gain;
+        return post(std::move(e));
+    }
+
+
+    bool
+    sequencer::set_position(long time, long voice, float azimuth, float distance)
+    {
+        event e;
+        e.type = event::position;
+        e.time = time;
+        e.voice = voice;
+        e.value = azimuth;
+        e.distance = distance;
+        return post(std::move(e));
+    }
+
+
+    bool
+    sequencer::stop(long time, long voice)
+    {
+        event e;
+        e.type = event::stop;
+        e.time = time;
+        e.voice = voice;
+        return post(std::move(e));
+    }
+
+
+    void
+    sequencer::reclaim()
+    {
+        std::lock_guard<std::mutex> lock(reclaim_mutex_);
+        std::unique_ptr<mixer::voice> v;
+        while(finished_.pop(v))
+        {
+            v.reset();
+            live_.fetch_sub(1);
+        }
+    }
+
+
+    bool
+    sequencer::idle() const
+    {
+        return pending_.empty() && mixer_.finished();
+    }
+
+
+    void
+    sequencer::apply(event & e)
+    {
+        if(e.type == event::trigger)
+        {
+            mixer_.add(std::move(e.sound));
+            return;
+        }
+        int index = mixer_.find(e.voice);
+        if(index < 0) // the voice has ended
+            return;
+        if(e.type == event::gain)
+            mixer_.set_gain(index, e.value);
+        else if(e.type == event::position)
+            mixer_.set_position(index, e.value, e.distance);
+        else
+            mixer_.stop(index);
+    }
+
+
+    void
+    sequencer::process(float * out, int n)
+    {
+        process(out, nullptr, n);
+    }
+
+
+    void
+    sequencer::process(float * const * out, int n)
+    {
+        process(nullptr, out, n);
+    }
+
+
+    void
+    sequencer::process(float * interleaved, float * const * planar, int n)
+    {
+        TRACE_SCOPE("sequencer::process");
+        no_alloc_scope guard("sequencer::process");
+        event e;
+        while(pending_.size() < pending_.capacity() && queue_.pop(e))
+        {
+            auto at = std::upper_bound(pending_.begin(), pending_.end(), e.time, [](long t, const event & p) { return t < p.time; });
+            pending_.insert(at, std::move(e));
+        }
+
+        int nc = mixer_.channels();
+        float * channels[mixer::max_channels];
+        long start = position_.load(std::memory_order_relaxed);
+        long end = start+n;
+        long position = start;
+        auto next = pending_.begin();
+        while(position < end)
+        {
+            for(; next != pending_.end() && next->time <= position; next++)
+                apply(*next);
+            long until = next != pending_.end() ? std::min(end, next->time) : end;
+            if(planar)
+            {
+                for(int c=0; c<nc; c++)
+                    channels[c] = planar[c]+(position-start);
+                mixer_.process(channels, int(until-position));
+            }
+            else
+                mixer_.process(interleaved+nc*(position-start), int(until-position));
+            position = until;
+        }
+        pending_.erase(pending_.begin(), next);
+        mixer_.remove_finished([&](std::unique_ptr<mixer::voice> && v) { return finished_.push(std::move(v)); });
+        position_.store(end, std::memory_order_release);
+    }
+};
@@ -0,0 +1,84 @@
+// sequencer.h - sample accurate scheduling of sounds (c) Christian Balkenius 2024
+//
+// Control threads post timestamped events: start a patch, change the gain or the position of a voice,
+// or stop it.
+// Times are in samples on the clock of the sequencer, which counts the samples rendered so far; now()
+// may be read from any thread to schedule relative to the current output. Events are passed through
+// a lock-free queue and may be posted from any number of threads at the same time.
+//
+// The audio thread calls process. It moves the posted events into a list ordered by time and splits
+// the block at every event, so an event takes effect exactly at its sample. Events that arrive too
+// late are applied at the start of the next block. Events with the same time are applied in the
+// order they were posted by a thread.
+//
+// The audio thread neither allocates nor frees. Voices are made by the thread that triggers them, and
+// voices that have ended are passed back through a second queue and freed by reclaim(), which trigger
+// calls and any control thread may call. At most capacity voices are alive at a time, from the trigger
+// until they are reclaimed, so the mixer never grows beyond the room reserved for them.
+
+#ifndef SEQUENCER
+#define SEQUENCER
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "mixer.h"
+#include "mpsc_queue.h"
+#include "patch.h"
+
+namespace ikaros
+{
+    class sequencer
+    {
+    public:
+        sequencer(int threads=0, int capacity=1024);  // threads for the mixer; capacity is the number of events in flight and of live voices
+
+        long now() const { return position_.load(std::memory_order_acquire); }
+
+        // Control threads; the trigger returns an id for the voice or -1 if the queue is full or capacity voices are alive
+
+        long trigger(long time, patch && sound, float gain=1, float duration=0, uint64_t seed=0);
+        bool set_gain(long time, long voice, float gain);
+        bool set_position(long time, long voice, float azimuth, float distance=1); // see mixer
+        bool stop(long time, long voice);
+        void reclaim();     // free the voices that have ended
+
+        // Audio thread
+
+        void process(float * out, int n);           // n frames of interleaved channels
+        void process(float * const * out, int n);   // planar
+        bool idle() const;   // no events received and waiting and no voice playing
+
+        mixer & voices() { return mixer_; }
+
+    private:
+        struct event
+        {
+            enum kind { trigger, gain, position, stop };
+
+            kind                            type = trigger;
+            long                            time = 0;
+            long                            voice = 0;
+            float                           value = 0;  // gain or azimuth
+            float                           distance = 1;
+            std::unique_ptr<mixer::voice>   sound;      // made by the posting thread so that the audio thread does not allocate
+        };
+
+        bool post(event && e);
+        void apply(event & e);
+        void process(float * interleaved, float * const * planar, int n); // one of the outputs is nullptr
+
+        mixer                   mixer_;
+        mpsc_queue<event>       queue_;
+        mpsc_queue<std::unique_ptr<mixer::voice>> finished_; // from the audio thread to reclaim()
+        std::mutex              reclaim_mutex_; // reclaim() is the single consumer of finished_
+        std::atomic<int>        live_{0};   // voices triggered and not yet reclaimed
+        std::vector<event>      pending_;   // ordered by time; never grows beyond its capacity
+        std::atomic<long>       position_{0};
+        std::atomic<long>       next_voice_{0};
+    };
+};
+
+#endif
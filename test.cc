@@ -0,0 +1,73 @@
+// test.cc   (c) Christian Balkenius 2024
+//
+//      unit_test [<name>]
+
+#include "test.h"
+
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <vector>
+
+namespace ikaros
+{
+    struct test_case
+    {
+        const char *    name;
+        void            (*test)();
+    };
+
+    static std::vector<test_case> &
+    tests()
+    {
+        static std::vector<test_case> t;
+        return t;
+    }
+
+    static int failed_checks = 0;
+
+
+    test_registration::test_registration(const char * name, void (*test)())
+    {
+        tests().push_back({name, test});
+    }
+
+
+    void
+    test_check(bool passed, const char * condition, const char * file, int line)
+    {
+        if(passed)
+            return;
+        std::printf("    %s:%d: CHECK(%s) failed\n", file, line, condition);
+        failed_checks++;
+    }
+};
+
+
+int
+main(int argc, char * argv[])
+{
+    std::string filter = argc > 1 ? argv[1] : "";
+    int failures = 0;
+    for(auto & t : ikaros::tests())
+    {
+        if(!filter.empty() && std::string(t.name).find(filter) == std::string::npos)
+            continue;
+        int before = ikaros::failed_checks;
+        bool thrown = false;
+        try
+        {
+            t.test();
+        }
+        catch(const std::exception & e)
+        {
+            std::printf("    %s threw: %s\n", t.name, e.what());
+            thrown = true;
+        }
+        bool pass = !thrown && ikaros::failed_checks == before;
+        std::printf("%-32s %s\n", t.name, pass ? "ok" : "FAIL");
+        failures += !pass;
+    }
+    std::printf("%d failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}
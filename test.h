@@ -0,0 +1,34 @@
+// test.h - unit tests of the library (c) Christian Balkenius 2024
+//
+// Each test_*.cc file defines its tests with TEST and checks conditions with CHECK. unit_test runs them
+// all, or those whose names contain its argument, prints every failed check with its file and line and
+// exits with status 1 if any check failed.
+//
+//      TEST(matrix_copy)
+//      {
+//          matrix a(2, 2), b(2, 2);
+//          b.copy(a);
+//          CHECK(b(1, 1) == 0);
+//      }
+
+#ifndef IKAROS_TEST_H
+#define IKAROS_TEST_H
+
+namespace ikaros
+{
+    struct test_registration
+    {
+        test_registration(const char * name, void (*test)());
+    };
+
+    void test_check(bool passed, const char * condition, const char * file, int line);
+};
+
+#define TEST(name) \
+    static void name(); \
+    static ikaros::test_registration name##_registration(#name, name); \
+    static void name()
+
+#define CHECK(condition) ikaros::test_check(bool(condition), #condition, __FILE__, __LINE__)
+
+#endif
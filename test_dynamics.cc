@@ -0,0 +1,127 @@
+// test_dynamics.cc   (c) Christian Balkenius 2024
+
+#include "test.h"
+
+#include <cmath>
+#include <vector>
+
+#include "dynamics.h"
+#include "resampler.h"
+
+using namespace ikaros;
+
+
+static std::vector<float>
+sine(int rate, int channels, float seconds, float frequency, float amplitude, float phase=0) // the same in all channels
+{
+    int n = int(seconds*rate);
+    std::vector<float> x(n*channels);
+    for(int i=0; i<n; i++)
+        for(int c=0; c<channels; c++)
+            x[i*channels+c] = amplitude*std::sin(2*M_PI*frequency*i/rate + phase);
+    return x;
+}
+
+
+static float
+true_peak(const std::vector<float> & x, int rate) // from eight times oversampling
+{
+    matrix m(int(x.size()));
+    for(int i=0; i<x.size(); i++)
+        m(i) = x[i];
+    matrix up = resample(m, rate, 8*rate);
+    float p = 0;
+    for(int i=0; i<up.size(); i++)
+        p = std::max(p, std::fabs(up(i)));
+    return p;
+}
+
+
+TEST(limiter_ceiling)
+{
+    const int rate = 44100;
+    const float ceiling = std::pow(10.0f, -1.0f/20);
+    std::vector<std::vector<float>> inputs = {
+        sine(rate, 1, 1, 1000, 2),
+        sine(rate, 1, 1, 11025, 1.2f, M_PI/4),  // samples at 0.85, the true peak at 1.2 between them
+        sine(rate, 1, 1, 15000, 1.5f, 0.3f),
+    };
+    std::vector<float> burst(rate, 0.0f);        // a sudden peak after silence
+    for(int i=rate/2; i<rate/2+300; i++)
+        burst[i] = 4*std::sin(0.9f*i);
+    inputs.push_back(burst);
+
+    for(auto & x : inputs)
+    {
+        limiter l(rate, 1);
+        l.process(x.data(), int(x.size()));
+        float sample_peak = 0;
+        for(float y : x)
+            sample_peak = std::max(sample_peak, std::fabs(y));
+        CHECK(sample_peak <= ceiling*1.001f);
+        CHECK(true_peak(x, rate) <= ceiling*std::pow(10.0f, 0.2f/20)); // within the error of the interpolator
+    }
+}
+
+
+TEST(limiter_below_ceiling)
+{
+    const int rate = 48000;
+    std::vector<float> x = sine(rate, 2, 0.5f, 440, 0.5f);
+    std::vector<float> y = x;
+    limiter l(rate, 2);
+    l.process(y.data(), int(y.size()/2));
+    int delay = l.latency()*2;
+    bool same = true;
+    for(int i=delay; i<y.size(); i++)
+        same = same && y[i] == x[i-delay];
+    CHECK(same);
+}
+
+
+TEST(loudness_reference)
+{
+    for(int rate : {44100, 48000})
+    {
+        std::vector<float> x = sine(rate, 2, 4, 997, std::pow(10.0f, -23.0f/20)); // -23 dBFS in both channels is -23 LUFS
+        loudness_normalizer n(rate, 2, -23);
+        n.process(x.data(), int(x.size()/2));
+        CHECK(std::fabs(n.loudness()+23) < 0.1f);
+        CHECK(std::fabs(n.gain()) < 0.1f);
+
+        std::vector<float> y = sine(rate, 1, 4, 997, std::pow(10.0f, -20.0f/20));   // -23.01 LUFS in one channel
+        loudness_normalizer m(rate, 1, -16);
+        m.process(y.data(), int(y.size()));
+        CHECK(std::fabs(m.loudness()+23.01f) < 0.1f);
+        CHECK(std::fabs(m.gain()-7.01f) < 0.1f);
+    }
+}
+
+
+TEST(dynamics_chunked)
+{
+    const int rate = 44100;
+    const int channels = 2;
+    std::vector<float> x = sine(rate, channels, 2, 300, 1.5f);
+    for(int i=0; i<x.size(); i++)
+        x[i] *= 0.1f + (i/channels % 20000)/10000.0f; // changes the level
+
+    std::vector<float> whole = x;
+    loudness_normalizer n1(rate, channels);
+    limiter l1(rate, channels);
+    n1.process(whole.data(), int(whole.size()/channels));
+    l1.process(whole.data(), int(whole.size()/channels));
+
+    std::vector<float> chunked = x;
+    loudness_normalizer n2(rate, channels);
+    limiter l2(rate, channels);
+    int frames = int(x.size()/channels);
+    for(int i=0, k=0; i<frames; k++)
+    {
+        int chunk = std::min(frames-i, 1 + (k*37) % 613);
+        n2.process(chunked.data()+i*channels, chunk);
+        l2.process(chunked.data()+i*channels, chunk);
+        i += chunk;
+    }
+    CHECK(chunked == whole);
+}
@@ -0,0 +1,83 @@
+// test_matrix.cc   (c) Christian Balkenius 2024
+
+#include "test.h"
+
+#include <utility>
+
+#include "matrix.h"
+
+using namespace ikaros;
+
+
+TEST(matrix_share_last_write)
+{
+    matrix m(4, 8);
+    m.set_last_mode(matrix::share_last);
+    m.test_fill();
+    m.last();           // saves the filled matrix
+    m(0, 0) = -1;
+    m.save();
+    m.test_fill();
+    CHECK(m.last()(0, 0) == -1);
+    CHECK(m(0, 0) == 0);
+}
+
+
+TEST(matrix_share_last_detach)
+{
+    matrix m(4, 8);
+    m.set_last_mode(matrix::share_last);
+    m.test_fill();
+    m.last();
+    m.save();
+    m.detach_last();
+    m.last()(1, 2) = -1;
+    CHECK(m(1, 2) == 10);
+    CHECK(m.last()(1, 2) == -1);
+}
+
+
+TEST(matrix_share_last_view)
+{
+    matrix m(4, 8);
+    m.test_fill();
+    matrix row = m[1];  // taken before last exists
+    matrix copy = m;
+    m.set_last_mode(matrix::share_last);
+    m.last();
+    row[2] = -1;
+    CHECK(m(1, 2) == -1);
+    CHECK(m.last()(1, 2) == 10);
+
+    m.save();
+    copy(3, 3) = -2;
+    CHECK(m(3, 3) == -2);
+    CHECK(m.last()(3, 3) == 27);
+}
+
+
+TEST(matrix_share_last_read)
+{
+    matrix m(4, 8);
+    m.set_last_mode(matrix::share_last);
+    m.test_fill();
+    m.last();
+    m.save();
+    const float * x = std::as_const(m).data();
+    CHECK(x[9] == 9);
+    CHECK(m.last().data_ == m.data_);    // reading did not copy
+}
+
+
+TEST(matrix_swap_last)
+{
+    matrix m(4, 8);
+    m.set_last_mode(matrix::swap_last);
+    m.test_fill();
+    m.last();
+    m(3, 7) = -1;
+    m.save();
+    m.test_fill();
+    CHECK(m.last()(3, 7) == -1);
+    CHECK(m(3, 7) == 31);
+}
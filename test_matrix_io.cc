@@ -0,0 +1,80 @@
+// test_matrix_io.cc   (c) Christian Balkenius 2024
+
+#include "test.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "matrix_io.h"
+
+using namespace ikaros;
+
+static const char * test_file = "/tmp/ikaros_test_matrix_io.ikmx";
+
+
+static std::string
+file_image(matrix & m)
+{
+    std::ostringstream os;
+    write_binary(os, m);
+    return os.str();
+}
+
+
+static bool
+loading_fails(const std::string & image)
+{
+    std::ofstream(test_file, std::ios::binary | std::ios::trunc) << image;
+    try
+    {
+        mapped_matrix m(test_file);
+    }
+    catch(const std::exception &)
+    {
+        return true;
+    }
+    return false;
+}
+
+
+template <typename T>
+static void
+patch(std::string & image, size_t position, T value)
+{
+    std::memcpy(&image[position], &value, sizeof(T));
+}
+
+
+TEST(matrix_io_round_trip)
+{
+    matrix m(3, 5);
+    m.test_fill();
+    save_binary(test_file, m);
+    matrix r = load_binary(test_file);
+    CHECK(r.shape() == m.shape());
+    CHECK(r(2, 4) == 14);
+}
+
+
+TEST(matrix_io_shape_overflow)
+{
+    matrix m(2, 2);
+    std::string image = file_image(m);
+    patch<int32_t>(image, 32, 65536);   // 65536 x 65536 wraps a 32-bit count
+    patch<int32_t>(image, 36, 65536);
+    patch<uint64_t>(image, 24, 0);
+    CHECK(loading_fails(image));
+}
+
+
+TEST(matrix_io_offset_overflow)
+{
+    matrix m(2, 2);
+    std::string image = file_image(m);
+    CHECK(!loading_fails(image));
+    patch<uint64_t>(image, 16, ~uint64_t(0)-15);  // offset + count*4 wraps to 0
+    CHECK(loading_fails(image));
+    patch<uint64_t>(image, 16, image.size());     // the payload would start at the end of the file
+    CHECK(loading_fails(image));
+}
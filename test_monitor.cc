@@ -0,0 +1,47 @@
+// test_monitor.cc   (c) Christian Balkenius 2024
+
+#include "test.h"
+
+#include <thread>
+#include <vector>
+
+#include "monitor.h"
+
+using namespace ikaros;
+
+
+TEST(monitor_voice_slots)
+{
+    audio_monitor monitor(44100, 4);
+    monitor.voice(1, 0, 3000000);
+    monitor.voice(1, 0, 1000000);
+    monitor.voice(6, 0, 2000000);
+    monitor.voice(-1, 0, 9000000); // counts only in the longest time
+    audio_stats s = monitor.stats();
+    CHECK(s.voices.size() == 2);
+    for(auto & v : s.voices)
+        CHECK((v.first == 1 && v.second == 3) || (v.first == 6 && v.second == 2));
+    CHECK(s.voice_max_ms == 9);
+
+    monitor.voice(5, 0, 1000000); // takes over the slot of tag 1
+    s = monitor.stats();
+    for(auto & v : s.voices)
+        CHECK(v.first != 1);
+}
+
+
+TEST(monitor_voice_collisions)
+{
+    audio_monitor monitor(44100, 1);
+    std::vector<std::thread> threads;
+    for(int t=0; t<4; t++)
+        threads.emplace_back([&monitor, t]() { // each tag has its own render time
+            for(int i=0; i<100000; i++)
+                monitor.voice(t, 0, (t+1)*1000000);
+        });
+    for(auto & t : threads)
+        t.join();
+    audio_stats s = monitor.stats();
+    CHECK(s.voices.size() == 1);
+    CHECK(s.voices.size() == 1 && s.voices[0].second == s.voices[0].first+1);
+}
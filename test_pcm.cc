@@ -0,0 +1,172 @@
+// test_pcm.cc   (c) Christian Balkenius 2024
+
+#include "test.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "pcm.h"
+
+using namespace ikaros;
+
+static const pcm_isa isas[] = {pcm_isa::scalar, pcm_isa::sse41, pcm_isa::avx2};
+static const pcm_format formats[] = {pcm_format::s16, pcm_format::s24, pcm_format::s32};
+
+
+static std::vector<float>
+test_signal(int n) // in range, out of range, infinite and NaN
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    std::vector<float> x(n);
+    for(int i=0; i<n; i++)
+        switch(i % 13)
+        {
+            case 3: x[i] = nan; break;
+            case 5: x[i] = inf; break;
+            case 7: x[i] = -inf; break;
+            case 9: x[i] = 1.5f; break;
+            case 11: x[i] = -3; break;
+            default: x[i] = 0.9f*std::sin(0.37f*i);
+        }
+    return x;
+}
+
+
+static int32_t
+sample(const std::vector<unsigned char> & data, int i, pcm_format format) // decoded to an integer
+{
+    if(format == pcm_format::s16)
+        return int16_t(data[2*i] | data[2*i+1] << 8);
+    if(format == pcm_format::s24)
+        return int32_t(uint32_t(data[3*i]) << 8 | uint32_t(data[3*i+1]) << 16 | uint32_t(data[3*i+2]) << 24) >> 8;
+    return int32_t(uint32_t(data[4*i]) | uint32_t(data[4*i+1]) << 8 | uint32_t(data[4*i+2]) << 16 | uint32_t(data[4*i+3]) << 24);
+}
+
+
+TEST(pcm_kernels_identical)
+{
+    for(int n : {1, 7, 8, 9, 10, 15, 16, 17, 23, 31, 33, 41, 1003})
+    {
+        std::vector<float> x = test_signal(n);
+        for(pcm_format format : formats)
+            for(bool dithered : {false, true})
+            {
+                std::vector<unsigned char> reference;
+                std::vector<float> decoded_reference;
+                for(pcm_isa isa : isas)
+                {
+                    if(isa > pcm_best_isa())
+                        continue;
+                    pcm_set_isa(isa);
+                    pcm_dither dither(7);
+                    std::vector<unsigned char> data(n*pcm_bytes(format)+1, 0xAA); // and a guard byte
+                    pcm_encode(x.data(), data.data(), n, format, dithered ? &dither : nullptr);
+                    CHECK(data.back() == 0xAA);
+                    std::vector<float> decoded(n);
+                    pcm_decode(data.data(), decoded.data(), n, format);
+                    if(isa == pcm_isa::scalar)
+                    {
+                        reference = data;
+                        decoded_reference = decoded;
+                    }
+                    else
+                    {
+                        CHECK(data == reference);
+                        CHECK(decoded == decoded_reference);
+                    }
+                }
+            }
+    }
+    pcm_set_isa(pcm_best_isa());
+}
+
+
+TEST(pcm_special_values)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    std::vector<float> x = {nan, -nan, inf, -inf, 1, -1, 2, -2, 0, 0.5f, -0.5f};
+    for(int copies=0; copies<3; copies++) // reaches the SIMD kernels
+        x.insert(x.end(), x.begin(), x.begin()+11);
+
+    for(pcm_isa isa : isas)
+    {
+        if(isa > pcm_best_isa())
+            continue;
+        pcm_set_isa(isa);
+        for(pcm_format format : formats)
+        {
+            int32_t hi = format == pcm_format::s16 ? 32767 : format == pcm_format::s24 ? 8388607 : 2147483520;
+            int32_t lo = format == pcm_format::s16 ? -32768 : format == pcm_format::s24 ? -8388608 : std::numeric_limits<int32_t>::min();
+            int32_t half = format == pcm_format::s16 ? 16384 : format == pcm_format::s24 ? 4194304 : 1073741824;
+            std::vector<unsigned char> data(x.size()*pcm_bytes(format));
+            pcm_encode(x.data(), data.data(), x.size(), format);
+            for(int i=0; i<x.size(); i+=11)
+            {
+                CHECK(sample(data, i, format) == 0);      // NaN
+                CHECK(sample(data, i+1, format) == 0);
+                CHECK(sample(data, i+2, format) == hi);   // inf
+                CHECK(sample(data, i+3, format) == lo);
+                CHECK(sample(data, i+4, format) == hi);   // 1 is above the largest value
+                CHECK(sample(data, i+5, format) == lo);
+                CHECK(sample(data, i+6, format) == hi);
+                CHECK(sample(data, i+7, format) == lo);
+                CHECK(sample(data, i+8, format) == 0);
+                CHECK(sample(data, i+9, format) == half);
+                CHECK(sample(data, i+10, format) == -half);
+            }
+        }
+    }
+    pcm_set_isa(pcm_best_isa());
+}
+
+
+TEST(pcm_round_trip)
+{
+    for(pcm_isa isa : isas)
+    {
+        if(isa > pcm_best_isa())
+            continue;
+        pcm_set_isa(isa);
+        for(int n : {5, 8, 19, 100})
+            for(pcm_format format : formats)
+                for(bool dithered : {false, true})
+                {
+                    std::vector<float> x(n);
+                    for(int i=0; i<n; i++)
+                        x[i] = 0.99f*std::sin(0.71f*i);
+                    pcm_dither dither(3);
+                    std::vector<unsigned char> data(n*pcm_bytes(format));
+                    pcm_encode(x.data(), data.data(), n, format, dithered ? &dither : nullptr);
+                    std::vector<float> y(n);
+                    pcm_decode(data.data(), y.data(), n, format);
+
+                    float lsb = format == pcm_format::s16 ? 1.0f/32768 : format == pcm_format::s24 ? 1.0f/8388608 : 1.0f/2147483648.0f;
+                    float tolerance = (dithered && format != pcm_format::s32 ? 1.5f : 0.5f)*lsb + std::fabs(x[0])*1e-7f;
+                    for(int i=0; i<n; i++)
+                        CHECK(std::fabs(y[i]-x[i]) <= tolerance + 1e-7f);
+                }
+    }
+    pcm_set_isa(pcm_best_isa());
+}
+
+
+TEST(pcm_encode_submatrix)
+{
+    matrix m(2, 8);
+    m.test_fill();
+    m.resize(2, 4);
+    m.apply([](float x) { return x/16; });
+    std::vector<unsigned char> data = pcm_encode(m, pcm_format::s16);
+    CHECK(data.size() == 8*2);
+    const int expected[] = {0, 1, 2, 3, 8, 9, 10, 11};
+    for(int i=0; i<8 && 2*i < data.size(); i++)
+        CHECK(sample(data, i, pcm_format::s16) == expected[i]*2048);
+
+    matrix row = m[1];
+    data = pcm_encode(row, pcm_format::s16);
+    CHECK(data.size() == 4*2);
+    CHECK(sample(data, 0, pcm_format::s16) == 8*2048);
+}
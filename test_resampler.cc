@@ -0,0 +1,60 @@
+// test_resampler.cc   (c) Christian Balkenius 2024
+
+#include "test.h"
+
+#include <cmath>
+
+#include "resampler.h"
+
+using namespace ikaros;
+
+
+TEST(resample_channels)
+{
+    matrix stereo(100, 2);
+    matrix left(100), right(100);
+    for(int i=0; i<100; i++)
+    {
+        stereo(i, 0) = left(i) = std::sin(0.1f*i);
+        stereo(i, 1) = right(i) = 0.5f*std::cos(0.03f*i);
+    }
+    matrix r = resample(stereo, 44100, 16000);
+    matrix l = resample(left, 44100, 16000);
+    matrix q = resample(right, 44100, 16000);
+    CHECK(r.rank() == 2);
+    CHECK(r.shape()[0] == l.shape()[0]);
+    CHECK(r.shape()[1] == 2);
+    bool same = true;
+    for(int i=0; i<l.shape()[0]; i++)
+        same = same && r(i, 0) == l(i) && r(i, 1) == q(i);
+    CHECK(same);
+}
+
+
+TEST(resample_submatrix)
+{
+    matrix m(100, 4);
+    for(int i=0; i<100; i++)
+        for(int c=0; c<4; c++)
+            m(i, c) = c == 0 ? std::sin(0.1f*i) : 1000;
+    m.resize(100, 1);   // the other columns are hidden
+    matrix mono(100);
+    for(int i=0; i<100; i++)
+        mono(i) = std::sin(0.1f*i);
+    matrix r = resample(m, 44100, 48000);
+    matrix s = resample(mono, 44100, 48000);
+    CHECK(r.rank() == 2 && r.shape()[1] == 1);
+    bool same = r.shape()[0] == s.shape()[0];
+    for(int i=0; same && i<s.shape()[0]; i++)
+        same = r(i, 0) == s(i);
+    CHECK(same);
+}
+
+
+TEST(resample_rank)
+{
+    matrix cube(4, 4, 4);
+    bool thrown = false;
+    try { resample(cube, 44100, 16000); } catch(const std::exception &) { thrown = true; }
+    CHECK(thrown);
+}
@@ -0,0 +1,139 @@
+// thread_pool.cc   (c) Christian Balkenius 2024
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#include "trace.h"
+
+namespace ikaros
+{
+    static thread_local bool inside_job = false; // set while a thread executes chunks; nested calls run sequentially
+
+    struct job_scope
+    {
+        bool previous;
+        job_scope() : previous(inside_job) { inside_job = true; }
+        ~job_scope() { inside_job = previous; }
+    };
+
+
+    thread_pool &
+    thread_pool::instance()
+    {
+        static thread_pool pool;
+        return pool;
+    }
+
+
+    thread_pool::thread_pool(int threads)
+    {
+        if(threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        for(int i=1; i<threads; i++)
+            workers_.emplace_back(&thread_pool::worker, this);
+    }
+
+
+    thread_pool::~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for(auto & t : workers_)
+            t.join();
+    }
+
+
+    void
+    thread_pool::run_chunks()
+    {
+        job_scope scope;
+        for(;;)
+        {
+            int a = next_.fetch_add(job_chunk_);
+            if(a >= job_end_)
+                return;
+            int b = std::min(a+job_chunk_, job_end_);
+            try
+            {
+                (*job_)(a, b);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if(!error_)
+                    error_ = std::current_exception();
+                next_ = job_end_; // let the other threads stop early
+            }
+        }
+    }
+
+
+    void
+    thread_pool::worker()
+    {
+        trace_thread();
+        long seen = 0;
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [&]{ return stop_ || generation_ != seen; });
+                if(stop_)
+                    return;
+                seen = generation_;
+            }
+
+            run_chunks();
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(--active_ == 0)
+                done_.notify_one();
+        }
+    }
+
+
+    void
+    thread_pool::parallel_for(int begin, int end, int grain, const std::function<void(int, int)> & f)
+    {
+        if(end <= begin)
+            return;
+        grain = std::max(1, grain);
+        int n = end-begin;
+        if(inside_job || workers_.empty() || n <= grain)
+        {
+            f(begin, end);
+            return;
+        }
+
+        std::lock_guard<std::mutex> call_lock(call_mutex_);
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            int tasks = 4*size(); // a few chunks per thread evens out the load
+            job_ = &f;
+            job_end_ = end;
+            job_chunk_ = std::max(grain, (n+tasks-1)/tasks);
+            next_ = begin;
+            active_ = int(workers_.size());
+            error_ = nullptr;
+            generation_++;
+        }
+        start_.notify_all();
+
+        run_chunks();
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [&]{ return active_ == 0; });
+            job_ = nullptr;
+            error = error_;
+            error_ = nullptr;
+        }
+        if(error)
+            std::rethrow_exception(error);
+    }
+};
@@ -0,0 +1,58 @@
+// thread_pool.h - shared worker threads for data parallel operations (c) Christian Balkenius 2024
+
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ikaros
+{
+    class thread_pool
+    {
+    public:
+        static thread_pool & instance(); // process-wide pool, started on first use
+
+        thread_pool(int threads=0);  // total number of threads including the caller; 0 = hardware concurrency
+        ~thread_pool();
+
+        thread_pool(const thread_pool &) = delete;
+        thread_pool & operator=(const thread_pool &) = delete;
+
+        int size() const { return int(workers_.size())+1; }
+
+        // Call f(a, b) for consecutive chunks of [begin, end) with at least grain iterations each.
+        // The calling thread takes part in the work and the call returns when all chunks are done.
+        // Nested calls from inside a chunk run sequentially. The first exception is rethrown in the caller.
+
+        void parallel_for(int begin, int end, int grain, const std::function<void(int, int)> & f);
+
+    private:
+        void worker();
+        void run_chunks();
+
+        std::vector<std::thread>    workers_;
+        std::mutex                  call_mutex_;    // one parallel_for at a time
+        std::mutex                  mutex_;
+        std::condition_variable     start_;
+        std::condition_variable     done_;
+        long                        generation_ = 0;
+        bool                        stop_ = false;
+
+        // current job
+
+        const std::function<void(int, int)> * job_ = nullptr;
+        int                 job_end_ = 0;
+        int                 job_chunk_ = 1;
+        std::atomic<int>    next_{0};
+        int                 active_ = 0;        // workers still inside the current job
+        std::exception_ptr  error_;
+    };
+};
+
+#endif
@@ -0,0 +1,217 @@
+// trace.cc   (c) Christian Balkenius 2024
+
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "exceptions.h"
+
+namespace ikaros
+{
+#ifdef IKAROS_TRACE
+
+    static const int trace_capacity = 1 << 16; // events per thread
+
+    struct trace_event
+    {
+        const char *    name;
+        int64_t         begin;
+        int64_t         end;
+    };
+
+    struct trace_buffer // written by its own thread only; count publishes the events to readers
+    {
+        int                         thread;
+        std::unique_ptr<trace_event[]> events{new trace_event[trace_capacity]};
+        std::atomic<int>            count{0};
+        std::atomic<long>           dropped{0};
+    };
+
+    static const int trace_max_threads = 256;
+
+    static std::mutex trace_mutex;
+    static std::unique_ptr<trace_buffer> trace_buffers[trace_max_threads]; // kept after their threads end; buffer i belongs to thread i+1
+    static std::atomic<int> trace_allocated{0};     // buffers in trace_buffers
+    static std::atomic<int> trace_claimed{0};       // buffers taken by threads; the rest are free
+    static std::atomic<long> trace_unbuffered{0};   // events of threads beyond trace_max_threads
+
+
+    static void
+    allocate_buffers(int n) // with trace_mutex held
+    {
+        int a = trace_allocated.load(std::memory_order_relaxed);
+        int end = std::min(a+n, trace_max_threads);
+        for(int i=a; i<end; i++)
+        {
+            trace_buffers[i] = std::make_unique<trace_buffer>();
+            trace_buffers[i]->thread = i+1;
+        }
+        trace_allocated.store(end, std::memory_order_release);
+    }
+
+
+    static trace_buffer *
+    claim_buffer() // the next free buffer, or a new one when none is free; null when there are too many threads
+    {
+        for(;;)
+        {
+            int c = trace_claimed.load(std::memory_order_relaxed);
+            if(c < trace_allocated.load(std::memory_order_acquire))
+            {
+                if(trace_claimed.compare_exchange_weak(c, c+1, std::memory_order_acq_rel))
+                    return trace_buffers[c].get();
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(trace_mutex);
+            if(trace_claimed.load(std::memory_order_relaxed) < trace_allocated.load(std::memory_order_relaxed))
+                continue; // another thread added buffers
+            if(trace_allocated.load(std::memory_order_relaxed) == trace_max_threads)
+                return nullptr;
+            allocate_buffers(1);
+        }
+    }
+
+
+    static trace_buffer *
+    local_buffer()
+    {
+        thread_local bool claimed = false;
+        thread_local trace_buffer * buffer = nullptr;
+        if(!claimed)
+        {
+            buffer = claim_buffer();
+            claimed = true;
+        }
+        return buffer;
+    }
+
+
+    void
+    trace_reserve(int threads)
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        int free = trace_allocated.load(std::memory_order_relaxed)-trace_claimed.load(std::memory_order_relaxed);
+        if(threads > free)
+            allocate_buffers(threads-free);
+    }
+
+
+    void
+    trace_thread()
+    {
+        local_buffer();
+    }
+
+
+    int64_t
+    trace_now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+
+    void
+    trace_record(const char * name, int64_t begin, int64_t end)
+    {
+        trace_buffer * buffer = local_buffer();
+        if(!buffer)
+        {
+            trace_unbuffered.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        trace_buffer & b = *buffer;
+        int n = b.count.load(std::memory_order_relaxed);
+        if(n == trace_capacity)
+        {
+            b.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        b.events[n] = {name, begin, end};
+        b.count.store(n+1, std::memory_order_release);
+    }
+
+
+    void
+    trace_write(const std::string & filename)
+    {
+        std::ofstream file(filename);
+        if(!file)
+            throw exception("Could not write trace \""+filename+"\".");
+
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        int buffers = trace_allocated.load(std::memory_order_relaxed);
+        int64_t origin = INT64_MAX;
+        for(int k=0; k<buffers; k++) // events are recorded when they end, so the earliest begin can be anywhere
+        {
+            auto & b = trace_buffers[k];
+            int n = b->count.load(std::memory_order_acquire);
+            for(int i=0; i<n; i++)
+                origin = std::min(origin, b->events[i].begin);
+        }
+
+        file << "{\"traceEvents\": [\n";
+        std::string sep;
+        for(int k=0; k<buffers; k++)
+        {
+            auto & b = trace_buffers[k];
+            int n = b->count.load(std::memory_order_acquire);
+            for(int i=0; i<n; i++)
+            {
+                trace_event & e = b->events[i];
+                file << sep << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->thread
+                     << ", \"ts\": " << (e.begin-origin)/1000.0 << ", \"dur\": " << (e.end-e.begin)/1000.0 << "}";
+                sep = ",\n";
+            }
+        }
+        file << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    }
+
+
+    void
+    trace_clear() // only while no thread records
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        for(int k=0; k<trace_allocated.load(std::memory_order_relaxed); k++)
+        {
+            trace_buffers[k]->count.store(0, std::memory_order_relaxed);
+            trace_buffers[k]->dropped.store(0, std::memory_order_relaxed);
+        }
+        trace_unbuffered.store(0, std::memory_order_relaxed);
+    }
+
+
+    long
+    trace_dropped()
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        long n = trace_unbuffered.load(std::memory_order_relaxed);
+        for(int k=0; k<trace_allocated.load(std::memory_order_relaxed); k++)
+            n += trace_buffers[k]->dropped.load(std::memory_order_relaxed);
+        return n;
+    }
+
+#else
+
+    void
+    trace_write(const std::string & filename)
+    {
+        std::ofstream file(filename);
+        if(!file)
+            throw exception("Could not write trace \""+filename+"\".");
+        file << "{\"traceEvents\": [], \"displayTimeUnit\": \"ms\"}\n";
+    }
+
+    void trace_clear() {}
+    long trace_dropped() { return 0; }
+    void trace_reserve(int threads) {}
+    void trace_thread() {}
+
+#endif
+};
@@ -0,0 +1,54 @@
+// trace.h - scoped trace events exported in Chrome trace format (c) Christian Balkenius 2024
+//
+// Compile with -DIKAROS_TRACE to record events; otherwise the macros expand to nothing and cost nothing.
+//
+//      void render() { TRACE_SCOPE("render"); ... }
+//      ikaros::trace_write("trace.json");  // open in chrome://tracing or ui.perfetto.dev
+//
+// Each thread records into a fixed buffer of its own, which it takes from a preallocated free list
+// without locking when it records its first event. Worker threads take theirs with trace_thread when they
+// start, and trace_reserve fills the list for threads that are started elsewhere, such as an audio callback
+// thread, so that no real-time thread allocates. A thread that finds the list empty allocates its buffer
+// under a lock. Names must be string literals or otherwise outlive the trace. Events that do not fit in
+// the buffer of a thread are counted and dropped.
+
+#ifndef IKAROS_TRACE_H
+#define IKAROS_TRACE_H
+
+#include <cstdint>
+#include <string>
+
+namespace ikaros
+{
+    void trace_write(const std::string & filename); // write the events recorded so far as Chrome trace JSON
+    void trace_clear();
+    long trace_dropped();                           // events that did not fit
+    void trace_reserve(int threads);                // make sure that buffers for this many more threads are free
+    void trace_thread();                            // take the buffer of the calling thread now
+
+#ifdef IKAROS_TRACE
+
+    int64_t trace_now();                            // nanoseconds
+    void trace_record(const char * name, int64_t begin, int64_t end);
+
+    struct trace_scope
+    {
+        const char *    name;
+        int64_t         begin;
+
+        trace_scope(const char * n) : name(n), begin(trace_now()) {}
+        ~trace_scope() { trace_record(name, begin, trace_now()); }
+    };
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) ikaros::trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+
+#endif
+};
+
+#endif
@@ -2,6 +2,9 @@
 
 #include "utilities.h"
 
+#include <algorithm>
+#include <limits>
+
 namespace ikaros
 {
 
@@ -125,18 +128,25 @@ rsplit(const std::string & str, const std::string & sep, int maxsplit)
 std::string
 join(const std::string & separator, const std::vector<std::string> & v, bool reverse)
 {
+    size_t n = v.empty() ? 0 : separator.size()*(v.size()-1);
+    for(auto & e : v)
+        n += e.size();
+
     std::string s;
+    s.reserve(n); // single allocation
     std::string sep;
     if(reverse)
-        for (auto & e : v)
+        for(auto e = v.rbegin(); e != v.rend(); e++)
         {
-            s = e + sep + s;
+            s += sep;
+            s += *e;
             sep = separator;
         }    
     else
         for (auto & e : v)
         {
-            s += sep + e;
+            s += sep;
+            s += e;
             sep = separator;
         }
     return s;
@@ -282,6 +292,265 @@ peek_rtail(const std::string & s, const std::string & delimiter)
 
 
 
+// STRING_VIEW VERSIONS
+
+std::string_view
+trim_view(std::string_view s)
+{
+    size_t a = 0;
+    size_t b = s.size();
+    while(a < b && std::isspace(static_cast<unsigned char>(s[a])))
+        a++;
+    while(b > a && std::isspace(static_cast<unsigned char>(s[b-1])))
+        b--;
+    return s.substr(a, b-a);
+}
+
+
+std::vector<std::string_view>
+split_view(std::string_view s, std::string_view sep, int maxsplit)
+{
+    std::vector<std::string_view> r;
+    size_t i=0, j=0;
+    size_t len = s.size();
+    size_t n = sep.size();
+
+    if (n == 0)
+    {
+        while(i<len)
+        {
+            while (i < len && ::isspace(s[i]))
+                i++;
+            j = i;
+            while (i < len && !::isspace(s[i]))
+                i++;
+
+            if(j < i)
+            {
+                if(maxsplit != -1 && maxsplit-- <= 0)
+                    break;
+                r.push_back(trim_view(s.substr(j, i-j)));
+                while(i < len && ::isspace(s[i]))
+                    i++;
+                j = i;
+            }
+        }
+        if (j < len)
+            r.push_back(trim_view(s.substr(j, len - j)));
+
+        return r;
+    }
+
+    while (i+n <= len)
+    {
+        if (s[i] == sep[0] && s.substr(i, n) == sep)
+        {
+            if(maxsplit != -1 && maxsplit-- <= 0)
+                break;
+
+            r.push_back(trim_view(s.substr(j, i - j)));
+            i = j = i + n;
+        }
+        else
+            i++;
+    }
+
+    r.push_back(trim_view(s.substr(j, len-j)));
+    return r;
+}
+
+
+std::vector<std::string_view>
+rsplit_view(std::string_view str, std::string_view sep, int maxsplit)
+{
+    if (maxsplit < 0)
+        return split_view(str, sep, maxsplit);
+
+    std::vector<std::string_view> r;
+    size_t i=str.size();
+    size_t j=str.size();
+    size_t n=sep.size();
+
+    if(n == 0)
+    {
+        while(i > 0)
+        {
+            while(i > 0 && ::isspace(str[i-1]))
+                i--;
+            j = i;
+            while(i > 0 && !::isspace(str[i-1]))
+                i--;
+
+            if (j > i)
+            {
+                if(maxsplit != -1 && maxsplit-- <= 0)
+                    break;
+                r.push_back(str.substr(i, j-i));
+                while(i > 0 && ::isspace(str[i-1]))
+                    i--;
+                j = i;
+            }
+        }
+        if (j > 0)
+            r.push_back(str.substr(0, j));
+    }
+    else
+    {
+        while(i >= n)
+        {
+            if(str[i-1] == sep[n-1] && str.substr(i-n, n) == sep)
+            {
+                if(maxsplit != -1 && maxsplit-- <= 0)
+                    break;
+                r.push_back(str.substr(i, j-i));
+                i = j = i-n;
+            }
+            else
+                i--;
+        }
+        r.push_back(str.substr(0, j));
+    }
+    
+    std::reverse(r.begin(), r.end());
+    return r;
+}
+
+
+std::string_view
+head(std::string_view & s, std::string_view delimiter)
+{
+    size_t end = s.find(delimiter);
+    std::string_view h = s.substr(0, end);
+    if(end == std::string_view::npos)
+        s = std::string_view();
+    else
+        s.remove_prefix(end+delimiter.size());
+    return h;
+}
+
+
+std::string_view
+rhead(std::string_view & s, std::string_view delimiter)
+{
+    size_t end = s.rfind(delimiter);
+    std::string_view h = s.substr(0, end);
+    if(end == std::string_view::npos)
+        s = std::string_view();
+    else
+        s.remove_prefix(end+delimiter.size());
+    return h;
+}
+
+
+std::string_view
+tail(std::string_view & s, std::string_view delimiter)
+{
+    size_t end = s.find(delimiter);
+    if(end == std::string_view::npos)
+        return std::string_view();
+
+    std::string_view t = s.substr(end+delimiter.size());
+    s = s.substr(0, end);
+    return t;
+}
+
+
+std::string_view
+rtail(std::string_view & s, std::string_view delimiter)
+{
+    size_t end = s.rfind(delimiter);
+    if(end == std::string_view::npos)
+        return std::string_view();
+
+    std::string_view t = s.substr(end+delimiter.size());
+    s = s.substr(0, end);
+    return t;
+}
+
+
+std::string_view
+peek_head_view(std::string_view s, std::string_view delimiter)
+{
+    return s.substr(0, s.find(delimiter));
+}
+
+
+std::string_view
+peek_rhead_view(std::string_view s, std::string_view delimiter)
+{
+    return s.substr(0, s.rfind(delimiter));
+}
+
+
+std::string_view
+peek_tail_view(std::string_view s, std::string_view delimiter, bool keep_delimiter)
+{
+    size_t end = s.find(delimiter);
+    if(end == std::string_view::npos)
+        return std::string_view();
+    return keep_delimiter ? s.substr(end) : s.substr(end+delimiter.size());
+}
+
+
+std::string_view
+peek_rtail_view(std::string_view s, std::string_view delimiter)
+{
+    size_t end = s.rfind(delimiter);
+    if(end == std::string_view::npos)
+        return std::string_view();
+    return s.substr(end+delimiter.size());
+}
+
+
+void
+split_range::iterator::next()
+{
+    const std::string_view & s = range_->s_;
+    const std::string_view & sep = range_->sep_;
+
+    if(next_ == std::string_view::npos)
+    {
+        pos_ = std::string_view::npos;
+        part_ = std::string_view();
+        return;
+    }
+
+    if(sep.empty()) // white space separates the parts and empty parts are skipped
+    {
+        size_t i = next_;
+        while(i < s.size() && ::isspace(s[i]))
+            i++;
+        if(i == s.size())
+        {
+            pos_ = next_ = std::string_view::npos;
+            part_ = std::string_view();
+            return;
+        }
+        size_t j = i;
+        while(j < s.size() && !::isspace(s[j]))
+            j++;
+        part_ = s.substr(i, j-i);
+        pos_ = i;
+        next_ = j;
+        return;
+    }
+
+    size_t k = s.find(sep, next_);
+    pos_ = next_;
+    if(k == std::string_view::npos)
+    {
+        part_ = trim_view(s.substr(next_));
+        next_ = std::string_view::npos;
+    }
+    else
+    {
+        part_ = trim_view(s.substr(next_, k-next_));
+        next_ = k+sep.size();
+    }
+}
+
+
+
 bool
 starts_with(const std::string & s, const std::string & start) // waiting for C++20
 {
@@ -483,39 +752,6 @@ std::ostream& operator<<(std::ostream& os, const std::vector<int> & v)
     }
 
 
-char *
-base64_encode(const unsigned char * data,
-              size_t size_in,
-              size_t *size_out)
-{
-    static char encoding_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    static int mod_table[] = {0, 2, 1};
-    *size_out = ((size_in - 1) / 3) * 4 + 4;
-    
-    char *encoded_data = (char *)malloc(*size_out);
-    if (encoded_data == NULL) return NULL;
-    
-    for (int i = 0, j = 0; i < size_in;)
-    {
-        unsigned int octet_a = i < size_in ? data[i++] : 0;
-        unsigned int octet_b = i < size_in ? data[i++] : 0;
-        unsigned int octet_c = i < size_in ? data[i++] : 0;
-        
-        unsigned int triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
-        
-        encoded_data[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
-    }
-    
-    for (int i = 0; i < mod_table[size_in % 3]; i++)
-        encoded_data[*size_out - 1 - i] = '=';
-    
-    return encoded_data;
-}
-
-
     std::string formatNumber(double value, int decimals)
     {
         std::ostringstream oss;
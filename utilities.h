@@ -4,9 +4,13 @@
 #define UTILITIES
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
 #include <sstream>
+#include <iterator>
+
+#include "base64.h"
 
 namespace ikaros
 {
@@ -34,6 +38,64 @@ namespace ikaros
 
     std::string cut_head(std::string & s, const std::string & delimiter); // return string before delimiter and remove it from s
 
+    // STRING_VIEW VERSIONS - return views into the original string and never allocate; the string must outlive the views
+
+    std::string_view trim_view(std::string_view s);
+
+    std::vector<std::string_view> split_view(std::string_view s, std::string_view sep, int maxsplit=-1); // same parts as split()
+    std::vector<std::string_view> rsplit_view(std::string_view s, std::string_view sep, int maxsplit=-1); // same parts as rsplit()
+
+    std::string_view head(std::string_view & s, std::string_view delimiter); // as head() but only moves the start of the view
+    std::string_view tail(std::string_view & s, std::string_view delimiter);
+    std::string_view rhead(std::string_view & s, std::string_view delimiter);
+    std::string_view rtail(std::string_view & s, std::string_view delimiter);
+
+    std::string_view peek_head_view(std::string_view s, std::string_view delimiter);
+    std::string_view peek_tail_view(std::string_view s, std::string_view delimiter, bool keep_delimiter=false);
+    std::string_view peek_rhead_view(std::string_view s, std::string_view delimiter);
+    std::string_view peek_rtail_view(std::string_view s, std::string_view delimiter);
+
+    class split_range // lazy version of split_view(): for(std::string_view part : split_range(s, ",")) ...
+    {
+    public:
+        class iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const std::string_view *;
+            using reference = const std::string_view &;
+
+            iterator(const split_range * r, size_t pos) : range_(r), pos_(pos), next_(pos) { if(pos != std::string_view::npos) next(); }
+
+            reference operator*() const { return part_; }
+            pointer operator->() const { return &part_; }
+            iterator & operator++() { next(); return *this; }
+            iterator operator++(int) { iterator tmp = *this; next(); return tmp; }
+
+            friend bool operator==(const iterator & a, const iterator & b) { return a.pos_ == b.pos_; }
+            friend bool operator!=(const iterator & a, const iterator & b) { return a.pos_ != b.pos_; }
+
+        private:
+            void next();
+
+            const split_range * range_;
+            size_t              pos_;   // start of the current part; npos at the end
+            size_t              next_;  // start of the remaining string; npos after the last part
+            std::string_view    part_;
+        };
+
+        split_range(std::string_view s, std::string_view sep) : s_(s), sep_(sep) {}
+
+        iterator begin() const { return iterator(this, 0); }
+        iterator end() const { return iterator(this, std::string_view::npos); }
+
+    private:
+        std::string_view s_;
+        std::string_view sep_;  // empty = split on white space
+    };
+
 
     bool is_integer(const std::string & s); // is s an interger?
     bool is_number(const std::string &s); // is s an int, float or double?
@@ -44,7 +106,7 @@ namespace ikaros
 
     // Utility functions
 
-    auto tab = [](int d){ return std::string(3*d, ' ');};
+    inline auto tab = [](int d){ return std::string(3*d, ' ');};
 
     void print_attribute_value(const std::string & name, int value, int indent=0);
     void print_attribute_value(const std::string & name, const std::string & value, int indent=0);
@@ -52,8 +114,6 @@ namespace ikaros
     void print_attribute_value(const std::string name, std::vector<float> & values, int indent=0, int max_items=0);
     void print_attribute_value(const std::string & name, const std::vector<std::vector<std::string>> &  values, int indent=0, int max_items=0);
 
-    char * base64_encode(const unsigned char * data, size_t size_in, size_t *size_out);
-
     std::string formatNumber(double value, int decimals=10); // remove trailing zeros
 
     class prime